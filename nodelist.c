@@ -0,0 +1,2345 @@
+/*
+ * nodelist.c
+ *
+ * Native implementation of Slurm host list expressions.  See
+ * nodelist.h for an overview.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include "nodelist.h"
+
+//
+
+static void*
+__nodelist_realloc(
+    void        *ptr,
+    size_t      size
+)
+{
+    void        *new_ptr = realloc(ptr, size);
+
+    if ( ! new_ptr ) {
+        fprintf(stderr, "FATAL:  unable to allocate memory for node list\n");
+        exit(ENOMEM);
+    }
+    return new_ptr;
+}
+
+//
+
+static inline int
+__nodelist_digits(
+    unsigned long   n
+)
+{
+    int             d = 1;
+
+    while ( n >= 10 ) n /= 10, d++;
+    return d;
+}
+
+static inline int
+__nodelist_zero_padded(
+    unsigned long   n,
+    int             width
+)
+{
+    int             d = __nodelist_digits(n);
+
+    return (width > d) ? (width - d) : 0;
+}
+
+static inline unsigned long
+__nodelist_pow10(
+    int             e
+)
+{
+    unsigned long   p = 1;
+
+    while ( e-- > 0 ) p *= 10;
+    return p;
+}
+
+static inline size_t
+__nodelist_num_len(
+    unsigned long   n,
+    int             width
+)
+{
+    int             d = __nodelist_digits(n);
+
+    return (width > d) ? width : d;
+}
+
+static size_t
+__nodelist_format_num(
+    char            *p,
+    unsigned long   n,
+    int             width
+)
+{
+    char            digits[24];
+    int             d = 0;
+    size_t          len = 0;
+
+    do {
+        digits[d++] = '0' + (n % 10);
+        n /= 10;
+    } while ( n );
+    while ( width-- > d ) p[len++] = '0';
+    while ( d ) p[len++] = digits[--d];
+    return len;
+}
+
+/*
+ * Port of Slurm's _width_equiv():  two zero-padded numbers are considered
+ * to be of equivalent width if at most one of them depends on its width
+ * for padding; on success the widths are reconciled.
+ */
+static bool
+__nodelist_width_equiv(
+    unsigned long   n,
+    int             *wn,
+    unsigned long   m,
+    int             *wm
+)
+{
+    int             npad, nmpad, mpad, mnpad;
+
+    if ( *wn == *wm ) return true;
+    npad = __nodelist_zero_padded(n, *wn);
+    nmpad = __nodelist_zero_padded(n, *wm);
+    mpad = __nodelist_zero_padded(m, *wm);
+    mnpad = __nodelist_zero_padded(m, *wn);
+    if ( (npad != nmpad) && (mpad != mnpad) ) return false;
+    if ( npad != nmpad ) {
+        *wm = *wn;
+    } else {
+        *wn = *wm;
+    }
+    return true;
+}
+
+//
+
+typedef struct {
+    const char      *prefix;
+    size_t          prefix_len;
+    unsigned long   num;
+    int             width;
+} nodelist_hostname_t;
+
+static void
+__nodelist_hostname_parse(
+    const char          *host,
+    size_t              host_len,
+    nodelist_hostname_t *hn
+)
+{
+    size_t              idx = host_len;
+
+    while ( (idx > 0) && isdigit((unsigned char)host[idx - 1]) ) idx--;
+    hn->prefix = host;
+    if ( (idx == host_len) || ((host_len - idx) > NODELIST_MAX_DIGITS) ) {
+        hn->prefix_len = host_len;
+        hn->num = 0;
+        hn->width = 0;
+    } else {
+        hn->prefix_len = idx;
+        hn->num = 0;
+        hn->width = host_len - idx;
+        while ( idx < host_len ) hn->num = 10 * hn->num + (host[idx++] - '0');
+    }
+}
+
+//
+
+static unsigned
+__nodelist_hash(
+    const char      *s,
+    size_t          len
+)
+{
+    unsigned        h = 2166136261u;
+
+    while ( len-- ) {
+        h ^= (unsigned char)*s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static int
+__nodelist_prefix_lookup(
+    const nodelist_t    *nl,
+    const char          *s,
+    size_t              len
+)
+{
+    if ( nl->prefix_hash_size ) {
+        unsigned        mask = nl->prefix_hash_size - 1;
+        unsigned        slot = __nodelist_hash(s, len) & mask;
+
+        while ( nl->prefix_hash[slot] ) {
+            const nodelist_prefix_t *p = &nl->prefix[nl->prefix_hash[slot] - 1];
+
+            if ( (p->len == len) && (memcmp(p->str, s, len) == 0) ) return nl->prefix_hash[slot] - 1;
+            slot = (slot + 1) & mask;
+        }
+    }
+    return -1;
+}
+
+static void
+__nodelist_prefix_rehash(
+    nodelist_t      *nl,
+    unsigned        new_size
+)
+{
+    unsigned        i, mask = new_size - 1;
+
+    free(nl->prefix_hash);
+    nl->prefix_hash = calloc(new_size, sizeof(unsigned));
+    if ( ! nl->prefix_hash ) {
+        fprintf(stderr, "FATAL:  unable to allocate memory for node list\n");
+        exit(ENOMEM);
+    }
+    nl->prefix_hash_size = new_size;
+    for ( i = 0; i < nl->prefix_count; i++ ) {
+        unsigned    slot = __nodelist_hash(nl->prefix[i].str, nl->prefix[i].len) & mask;
+
+        while ( nl->prefix_hash[slot] ) slot = (slot + 1) & mask;
+        nl->prefix_hash[slot] = i + 1;
+    }
+}
+
+static unsigned
+__nodelist_prefix_intern(
+    nodelist_t      *nl,
+    const char      *s,
+    size_t          len
+)
+{
+    int             id = __nodelist_prefix_lookup(nl, s, len);
+
+    if ( id < 0 ) {
+        nodelist_prefix_t   *p;
+
+        if ( nl->prefix_count == nl->prefix_capacity ) {
+            nl->prefix_capacity = nl->prefix_capacity ? 2 * nl->prefix_capacity : 8;
+            nl->prefix = __nodelist_realloc(nl->prefix, nl->prefix_capacity * sizeof(nodelist_prefix_t));
+        }
+        id = nl->prefix_count++;
+        p = &nl->prefix[id];
+        p->str = __nodelist_realloc(NULL, len + 1);
+        memcpy(p->str, s, len);
+        p->str[len] = '\0';
+        p->len = len;
+        if ( len > nl->prefix_len_max ) nl->prefix_len_max = len;
+
+        /* Keep the table at most half full: */
+        if ( 2 * nl->prefix_count > nl->prefix_hash_size ) {
+            __nodelist_prefix_rehash(nl, nl->prefix_hash_size ? 2 * nl->prefix_hash_size : 16);
+        } else {
+            unsigned    mask = nl->prefix_hash_size - 1;
+            unsigned    slot = __nodelist_hash(s, len) & mask;
+
+            while ( nl->prefix_hash[slot] ) slot = (slot + 1) & mask;
+            nl->prefix_hash[slot] = id + 1;
+        }
+    }
+    return (unsigned)id;
+}
+
+//
+
+nodelist_t*
+nodelist_create(void)
+{
+    nodelist_t      *nl = calloc(1, sizeof(nodelist_t));
+
+    if ( ! nl ) {
+        fprintf(stderr, "FATAL:  unable to allocate memory for node list\n");
+        exit(ENOMEM);
+    }
+    return nl;
+}
+
+//
+
+nodelist_t*
+nodelist_create_partial(void)
+{
+    nodelist_t      *nl = nodelist_create();
+
+    nl->partial = true;
+    return nl;
+}
+
+//
+
+void
+nodelist_destroy(
+    nodelist_t      *nl
+)
+{
+    if ( nl ) {
+        unsigned    i;
+
+        for ( i = 0; i < nl->prefix_count; i++ ) free(nl->prefix[i].str);
+        free(nl->prefix);
+        free(nl->prefix_hash);
+        free(nl->range);
+        free(nl);
+    }
+}
+
+//
+
+/*
+ * Number of the host <offset> places into a range, in list order, and
+ * the reverse.
+ */
+static inline unsigned long
+__nodelist_range_num(
+    const nodelist_range_t  *r,
+    size_t                  offset
+)
+{
+    return r->descending ? (r->hi - offset) : (r->lo + offset);
+}
+
+static inline size_t
+__nodelist_range_offset(
+    const nodelist_range_t  *r,
+    unsigned long           num
+)
+{
+    return (size_t)(r->descending ? (r->hi - num) : (num - r->lo));
+}
+
+/*
+ * Keep hosts [start,end) of a range (counted in list order).
+ */
+static inline void
+__nodelist_range_trim(
+    nodelist_range_t        *r,
+    size_t                  start,
+    size_t                  end
+)
+{
+    unsigned long           first = __nodelist_range_num(r, start), last = __nodelist_range_num(r, end - 1);
+
+    if ( r->descending ) {
+        r->hi = first;
+        r->lo = last;
+    } else {
+        r->lo = first;
+        r->hi = last;
+    }
+}
+
+//
+
+/*
+ * Append a range, joining it to the tail range when it directly follows
+ * it (the same test Slurm's hostlist_push_range() applies, and its mirror
+ * image for descending ranges).
+ */
+static void
+__nodelist_append(
+    nodelist_t              *nl,
+    const nodelist_range_t  *r
+)
+{
+    if ( nl->range_count && ! nl->partial ) {
+        nodelist_range_t    *tail = &nl->range[nl->range_count - 1];
+
+        if ( (tail->prefix_id == r->prefix_id) && tail->width && r->width && (tail->descending == r->descending) &&
+                    (r->descending ? (r->hi + 1 == tail->lo) : (tail->hi + 1 == r->lo)) ) {
+            int             w_tail = tail->width, w_r = r->width;
+
+            if ( __nodelist_width_equiv(tail->lo, &w_tail, r->lo, &w_r) ) {
+                tail->width = w_tail;
+                if ( r->descending ) tail->lo = r->lo;
+                else tail->hi = r->hi;
+                nl->host_count += nodelist_range_count(r);
+                return;
+            }
+        }
+    }
+    if ( nl->range_count == nl->range_capacity ) {
+        nl->range_capacity = nl->range_capacity ? 2 * nl->range_capacity : 16;
+        nl->range = __nodelist_realloc(nl->range, nl->range_capacity * sizeof(nodelist_range_t));
+    }
+    nl->range[nl->range_count++] = *r;
+    nl->host_count += nodelist_range_count(r);
+}
+
+//
+
+void
+nodelist_push_range(
+    nodelist_t      *nl,
+    const char      *prefix,
+    size_t          prefix_len,
+    unsigned long   lo,
+    unsigned long   hi,
+    int             width
+)
+{
+    nodelist_range_t    r;
+
+    r.prefix_id = __nodelist_prefix_intern(nl, prefix, prefix_len);
+    r.width = width;
+    r.descending = false;
+    r.lo = lo;
+    r.hi = hi;
+    __nodelist_append(nl, &r);
+}
+
+//
+
+void
+nodelist_append_list(
+    nodelist_t          *nl,
+    const nodelist_t    *other
+)
+{
+    unsigned            *prefix_map;
+    size_t              i;
+
+    if ( ! other->range_count ) return;
+
+    /* Translate the other list's prefix ids to ours once up front: */
+    prefix_map = __nodelist_realloc(NULL, other->prefix_count * sizeof(unsigned));
+    for ( i = 0; i < other->prefix_count; i++ ) {
+        prefix_map[i] = __nodelist_prefix_intern(nl, other->prefix[i].str, other->prefix[i].len);
+    }
+    if ( nl->range_count + other->range_count > nl->range_capacity ) {
+        nl->range_capacity = nl->range_count + other->range_count;
+        nl->range = __nodelist_realloc(nl->range, nl->range_capacity * sizeof(nodelist_range_t));
+    }
+    for ( i = 0; i < other->range_count; i++ ) {
+        nodelist_range_t    r = other->range[i];
+
+        r.prefix_id = prefix_map[r.prefix_id];
+        __nodelist_append(nl, &r);
+    }
+    free(prefix_map);
+}
+
+//
+
+bool
+nodelist_push_host(
+    nodelist_t      *nl,
+    const char      *host,
+    size_t          host_len
+)
+{
+    nodelist_hostname_t hn;
+
+    if ( host_len == 0 ) return false;
+    __nodelist_hostname_parse(host, host_len, &hn);
+    nodelist_push_range(nl, hn.prefix, hn.prefix_len, hn.num, hn.num, hn.width);
+    return true;
+}
+
+//
+
+static bool
+__nodelist_parse_number(
+    const char      **s,
+    const char      *end,
+    unsigned long   *value,
+    int             *width
+)
+{
+    const char      *p = *s;
+    unsigned long   v = 0;
+
+    while ( (p < end) && isdigit((unsigned char)*p) ) {
+        if ( (p - *s) >= NODELIST_MAX_DIGITS ) return false;
+        v = 10 * v + (*p++ - '0');
+    }
+    if ( p == *s ) return false;
+    *width = p - *s;
+    *value = v;
+    *s = p;
+    return true;
+}
+
+static bool
+__nodelist_push_token(
+    nodelist_t      *nl,
+    const char      *tok,
+    size_t          tok_len
+)
+{
+    const char      *tok_end = tok + tok_len;
+    const char      *lbracket = memchr(tok, '[', tok_len);
+    const char      *rbracket, *suffix, *p;
+    size_t          prefix_len, suffix_len;
+    char            *host = NULL;
+    bool            rc = true;
+
+    if ( ! lbracket ) return nodelist_push_host(nl, tok, tok_len);
+
+    rbracket = memchr(lbracket, ']', tok_end - lbracket);
+    if ( ! rbracket || (rbracket == lbracket + 1) ) return false;
+    prefix_len = lbracket - tok;
+    suffix = rbracket + 1;
+    suffix_len = tok_end - suffix;
+
+    /* With text following the brackets each name is built in full and
+     * re-parsed (it may contain further bracketed ranges):
+     */
+    if ( suffix_len ) host = __nodelist_realloc(NULL, prefix_len + NODELIST_MAX_DIGITS + suffix_len);
+
+    p = lbracket + 1;
+    while ( rc && (p < rbracket) ) {
+        unsigned long   lo, hi;
+        int             width, hi_width;
+
+        if ( ! __nodelist_parse_number(&p, rbracket, &lo, &width) ) { rc = false; break; }
+        hi = lo;
+        if ( (p < rbracket) && (*p == '-') ) {
+            p++;
+            if ( ! __nodelist_parse_number(&p, rbracket, &hi, &hi_width) ) { rc = false; break; }
+        }
+        if ( lo > hi ) { rc = false; break; }
+        if ( p < rbracket ) {
+            if ( (*p != ',') || (p + 1 == rbracket) ) { rc = false; break; }
+            p++;
+        }
+        if ( host ) {
+            memcpy(host, tok, prefix_len);
+            while ( rc ) {
+                size_t  host_len = prefix_len + __nodelist_format_num(host + prefix_len, lo, width);
+
+                memcpy(host + host_len, suffix, suffix_len);
+                rc = __nodelist_push_token(nl, host, host_len + suffix_len);
+                if ( lo++ == hi ) break;
+            }
+        } else {
+            nodelist_push_range(nl, tok, prefix_len, lo, hi, width);
+        }
+    }
+    if ( host ) free(host);
+    return rc;
+}
+
+static inline bool
+__nodelist_is_separator(
+    char            c
+)
+{
+    return (c == ',') || (c == ' ') || (c == '\t') || (c == '\n') || (c == '\r');
+}
+
+bool
+nodelist_push_len(
+    nodelist_t      *nl,
+    const char      *expr,
+    size_t          expr_len
+)
+{
+    const char          *p = expr, *end = expr + expr_len;
+    size_t              saved_range_count = nl->range_count;
+    size_t              saved_host_count = nl->host_count;
+    nodelist_range_t    saved_tail;
+
+    if ( saved_range_count ) saved_tail = nl->range[saved_range_count - 1];
+    while ( p < end ) {
+        const char      *s;
+        int             depth = 0;
+
+        while ( (p < end) && __nodelist_is_separator(*p) ) p++;
+        if ( p == end ) break;
+        s = p;
+        while ( (p < end) && (depth || ! __nodelist_is_separator(*p)) ) {
+            if ( *p == '[' ) depth++;
+            else if ( (*p == ']') && depth ) depth--;
+            p++;
+        }
+        if ( ! __nodelist_push_token(nl, s, p - s) ) {
+            /* Like Slurm, an invalid expression adds nothing at all: */
+            nl->range_count = saved_range_count;
+            nl->host_count = saved_host_count;
+            if ( saved_range_count ) nl->range[saved_range_count - 1] = saved_tail;
+            fprintf(stderr, "ERROR:  invalid host expression: %.*s\n", (int)expr_len, expr);
+            return false;
+        }
+    }
+    return true;
+}
+
+//
+
+bool
+nodelist_push(
+    nodelist_t      *nl,
+    const char      *expr
+)
+{
+    return nodelist_push_len(nl, expr, strlen(expr));
+}
+
+//
+
+/*
+ * Natural-order comparison of two prefixes (runs of digits compare
+ * numerically), as with Slurm's use of strnatcmp().
+ */
+static int
+__nodelist_natcmp(
+    const char      *a,
+    const char      *b
+)
+{
+    while ( *a && *b ) {
+        if ( isdigit((unsigned char)*a) && isdigit((unsigned char)*b) ) {
+            const char  *a_start, *b_start;
+            size_t      a_len, b_len;
+
+            while ( *a == '0' ) a++;
+            while ( *b == '0' ) b++;
+            a_start = a; b_start = b;
+            while ( isdigit((unsigned char)*a) ) a++;
+            while ( isdigit((unsigned char)*b) ) b++;
+            a_len = a - a_start; b_len = b - b_start;
+            if ( a_len != b_len ) return (a_len < b_len) ? -1 : 1;
+            if ( a_len ) {
+                int     rc = memcmp(a_start, b_start, a_len);
+
+                if ( rc ) return rc;
+            }
+        } else {
+            if ( *a != *b ) return (unsigned char)*a - (unsigned char)*b;
+            a++, b++;
+        }
+    }
+    return (unsigned char)*a - (unsigned char)*b;
+}
+
+typedef struct {
+    const nodelist_t    *nl;
+    unsigned            id;
+} nodelist_prefix_sort_t;
+
+static int
+__nodelist_prefix_sort_cmp(
+    const void      *a,
+    const void      *b
+)
+{
+    const nodelist_prefix_sort_t  *A = a, *B = b;
+    const char                    *a_str = A->nl->prefix[A->id].str;
+    const char                    *b_str = B->nl->prefix[B->id].str;
+    int                           rc = __nodelist_natcmp(a_str, b_str);
+
+    return rc ? rc : strcmp(a_str, b_str);
+}
+
+typedef struct {
+    unsigned            rank;
+    nodelist_range_t    r;
+} nodelist_range_sort_t;
+
+static int
+__nodelist_range_sort_cmp(
+    const void      *a,
+    const void      *b
+)
+{
+    const nodelist_range_sort_t   *A = a, *B = b;
+    int                           w_a = A->r.width, w_b = B->r.width;
+
+    if ( A->rank != B->rank ) return (A->rank < B->rank) ? -1 : 1;
+    /* Single names sort ahead of numbered ranges: */
+    if ( ! w_a || ! w_b ) return (w_a ? 1 : 0) - (w_b ? 1 : 0);
+    if ( __nodelist_width_equiv(A->r.lo, &w_a, B->r.lo, &w_b) ) {
+        if ( A->r.lo != B->r.lo ) return (A->r.lo < B->r.lo) ? -1 : 1;
+        return 0;
+    }
+    return A->r.width - B->r.width;
+}
+
+/*
+ * Stable LSD radix sort on keys of <key_count> 64-bit words, least
+ * significant first.  Bytes that are equal across all keys need no pass
+ * of their own.  With more than one thread each pass is split into equal
+ * parts:  every part counts its own keys, the counts give each part its
+ * own slots in every bucket, and the parts then scatter independently.
+ */
+typedef uint64_t (*__nodelist_radix_key_fn)(const void *elem, int word);
+
+#define NODELIST_RADIX_PART_MIN     (64 * 1024)
+
+typedef struct {
+    const char              *src;
+    char                    *dst;
+    size_t                  start, end, size;
+    __nodelist_radix_key_fn key;
+    int                     word;
+    unsigned                shift;
+    int                     phase;          /* 0 => key bounds, 1 => count, 2 => scatter */
+    pthread_t               thread;
+    uint64_t                key_or, key_and;
+    size_t                  count[256];
+} __nodelist_radix_part_t;
+
+static void*
+__nodelist_radix_part_run(
+    void                    *arg
+)
+{
+    __nodelist_radix_part_t *part = arg;
+    size_t                  i;
+
+    switch ( part->phase ) {
+
+        case 0:
+            part->key_or = 0;
+            part->key_and = ~(uint64_t)0;
+            for ( i = part->start; i < part->end; i++ ) {
+                uint64_t    k = part->key(part->src + i * part->size, part->word);
+
+                part->key_or |= k;
+                part->key_and &= k;
+            }
+            break;
+
+        case 1:
+            memset(part->count, 0, sizeof(part->count));
+            for ( i = part->start; i < part->end; i++ ) {
+                part->count[(part->key(part->src + i * part->size, part->word) >> part->shift) & 0xff]++;
+            }
+            break;
+
+        case 2:
+            for ( i = part->start; i < part->end; i++ ) {
+                const char  *elem = part->src + i * part->size;
+                size_t      slot = part->count[(part->key(elem, part->word) >> part->shift) & 0xff]++;
+
+                memcpy(part->dst + slot * part->size, elem, part->size);
+            }
+            break;
+
+    }
+    return NULL;
+}
+
+static void
+__nodelist_radix_phase(
+    __nodelist_radix_part_t *parts,
+    unsigned                part_count,
+    int                     phase
+)
+{
+    unsigned                i, started = 0;
+
+    for ( i = 0; i < part_count; i++ ) parts[i].phase = phase;
+    /* A part whose thread cannot be started is run here instead: */
+    for ( i = 1; i < part_count; i++ ) {
+        if ( pthread_create(&parts[i].thread, NULL, __nodelist_radix_part_run, &parts[i]) != 0 ) break;
+        started = i;
+    }
+    __nodelist_radix_part_run(&parts[0]);
+    for ( i = started + 1; i < part_count; i++ ) __nodelist_radix_part_run(&parts[i]);
+    for ( i = 1; i <= started; i++ ) pthread_join(parts[i].thread, NULL);
+}
+
+static void
+__nodelist_radix_sort(
+    void                    *base,
+    size_t                  n,
+    size_t                  size,
+    int                     key_count,
+    __nodelist_radix_key_fn key,
+    unsigned                threads
+)
+{
+    char                    *tmp = __nodelist_realloc(NULL, n * size);
+    char                    *src = base, *dst = tmp, *swap;
+    unsigned                part_count = threads ? threads : 1, t;
+    __nodelist_radix_part_t *parts;
+    int                     word, byte;
+
+    if ( part_count > n / NODELIST_RADIX_PART_MIN ) part_count = n / NODELIST_RADIX_PART_MIN;
+    if ( part_count < 1 ) part_count = 1;
+    parts = __nodelist_realloc(NULL, part_count * sizeof(__nodelist_radix_part_t));
+    for ( t = 0; t < part_count; t++ ) {
+        parts[t].start = n * t / part_count;
+        parts[t].end = n * (t + 1) / part_count;
+        parts[t].size = size;
+        parts[t].key = key;
+    }
+    for ( word = 0; word < key_count; word++ ) {
+        uint64_t            varying, key_or = 0, key_and = ~(uint64_t)0;
+
+        for ( t = 0; t < part_count; t++ ) {
+            parts[t].src = src;
+            parts[t].word = word;
+        }
+        __nodelist_radix_phase(parts, part_count, 0);
+        for ( t = 0; t < part_count; t++ ) {
+            key_or |= parts[t].key_or;
+            key_and &= parts[t].key_and;
+        }
+        varying = key_or ^ key_and;
+        for ( byte = 0; byte < 8; byte++ ) {
+            size_t          total = 0, b;
+
+            if ( ! ((varying >> (8 * byte)) & 0xff) ) continue;
+            for ( t = 0; t < part_count; t++ ) {
+                parts[t].src = src;
+                parts[t].dst = dst;
+                parts[t].shift = 8 * byte;
+            }
+            __nodelist_radix_phase(parts, part_count, 1);
+            /* Bucket by bucket, each part's slots follow the previous part's: */
+            for ( b = 0; b < 256; b++ ) {
+                for ( t = 0; t < part_count; t++ ) {
+                    size_t  c = parts[t].count[b];
+
+                    parts[t].count[b] = total;
+                    total += c;
+                }
+            }
+            __nodelist_radix_phase(parts, part_count, 2);
+            swap = src, src = dst, dst = swap;
+        }
+    }
+    if ( src != (char*)base ) memcpy(base, src, n * size);
+    free(parts);
+    free(tmp);
+}
+
+/*
+ * When every prefix's numbered ranges share one width the comparison above
+ * reduces to the key (prefix rank, numbered, lo), so the radix sort gives
+ * the same order.
+ */
+static uint64_t
+__nodelist_range_sort_key(
+    const void                  *elem,
+    int                         word
+)
+{
+    const nodelist_range_sort_t *s = elem;
+
+    return word ? (((uint64_t)s->rank << 1) | (s->r.width != 0)) : (uint64_t)s->r.lo;
+}
+
+/*
+ * Rank the prefixes once in natural order so that sorting the ranges need
+ * not compare strings; the caller frees the returned array.
+ */
+static unsigned*
+__nodelist_prefix_ranks(
+    const nodelist_t        *nl
+)
+{
+    nodelist_prefix_sort_t  *prefixes = __nodelist_realloc(NULL, (nl->prefix_count + 1) * sizeof(nodelist_prefix_sort_t));
+    unsigned                *rank = __nodelist_realloc(NULL, (nl->prefix_count + 1) * sizeof(unsigned));
+    size_t                  i;
+
+    for ( i = 0; i < nl->prefix_count; i++ ) {
+        prefixes[i].nl = nl;
+        prefixes[i].id = i;
+    }
+    qsort(prefixes, nl->prefix_count, sizeof(nodelist_prefix_sort_t), __nodelist_prefix_sort_cmp);
+    for ( i = 0; i < nl->prefix_count; i++ ) rank[prefixes[i].id] = i;
+    free(prefixes);
+    return rank;
+}
+
+void
+nodelist_uniq(
+    nodelist_t      *nl
+)
+{
+    nodelist_range_sort_t   *ranges;
+    unsigned                *rank;
+    int                     *width;
+    bool                    one_width = true;
+    size_t                  i, n_out;
+
+    if ( nl->range_count < 1 ) return;
+
+    rank = __nodelist_prefix_ranks(nl);
+
+    ranges = __nodelist_realloc(NULL, nl->range_count * sizeof(nodelist_range_sort_t));
+    width = __nodelist_realloc(NULL, nl->prefix_count * sizeof(int));
+    for ( i = 0; i < nl->prefix_count; i++ ) width[i] = 0;
+    for ( i = 0; i < nl->range_count; i++ ) {
+        const nodelist_range_t  *r = &nl->range[i];
+
+        ranges[i].rank = rank[r->prefix_id];
+        ranges[i].r = *r;
+        ranges[i].r.descending = false;
+        if ( r->width ) {
+            if ( ! width[r->prefix_id] ) width[r->prefix_id] = r->width;
+            else if ( width[r->prefix_id] != r->width ) one_width = false;
+        }
+    }
+    free(rank);
+    free(width);
+    if ( one_width ) {
+        __nodelist_radix_sort(ranges, nl->range_count, sizeof(nodelist_range_sort_t), 2, __nodelist_range_sort_key, 1);
+    } else {
+        /* Mixed widths compare by Slurm's rules, which are not a key order: */
+        qsort(ranges, nl->range_count, sizeof(nodelist_range_sort_t), __nodelist_range_sort_cmp);
+    }
+
+    /* Coalesce duplicate, overlapping and adjacent ranges (Slurm's
+     * hostrange_join()):
+     */
+    nl->range[0] = ranges[0].r;
+    nl->host_count = nodelist_range_count(&nl->range[0]);
+    n_out = 1;
+    for ( i = 1; i < nl->range_count; i++ ) {
+        nodelist_range_t    *prev = &nl->range[n_out - 1];
+        nodelist_range_t    *cur = &ranges[i].r;
+        int                 w_prev = prev->width, w_cur = cur->width;
+
+        if ( (prev->prefix_id == cur->prefix_id) && (! w_prev == ! w_cur) ) {
+            if ( ! w_prev ) continue;
+            if ( __nodelist_width_equiv(prev->lo, &w_prev, cur->lo, &w_cur) && (prev->hi + 1 >= cur->lo) ) {
+                prev->width = w_prev;
+                if ( cur->hi > prev->hi ) {
+                    nl->host_count += cur->hi - prev->hi;
+                    prev->hi = cur->hi;
+                }
+                continue;
+            }
+        }
+        nl->range[n_out++] = *cur;
+        nl->host_count += nodelist_range_count(cur);
+    }
+    nl->range_count = n_out;
+    free(ranges);
+}
+
+//
+
+/*
+ * Numbers below this bound print with zero padding at the given width.
+ */
+static inline unsigned long
+__nodelist_padded_bound(
+    int             width
+)
+{
+    return (width > 1) ? __nodelist_pow10(width - 1) : 0;
+}
+
+//
+
+/*
+ * Stable duplicate removal.  Each range is cut into the pieces that print
+ * alike (padded to its width, or unpadded), and the pieces of each prefix
+ * and padding class are swept in order of their numbers with a heap of
+ * the pieces covering the sweep point:  every stretch of numbers belongs
+ * to the earliest range covering it.  The stretches are then put back in
+ * input order.
+ */
+typedef struct {
+    unsigned        prefix_id;
+    int             padded_width;   /* 0 => unpadded, -1 => single name */
+    int             width;
+    unsigned long   lo, hi;
+    size_t          order;          /* index of the range it came from */
+} nodelist_stable_piece_t;
+
+/*
+ * Pieces are made in input order, so the stable radix sort leaves pieces
+ * with equal keys in input order.
+ */
+static uint64_t
+__nodelist_stable_piece_key(
+    const void                      *elem,
+    int                             word
+)
+{
+    const nodelist_stable_piece_t   *p = elem;
+
+    return word ? (((uint64_t)p->prefix_id << 32) | (uint32_t)(p->padded_width + 1)) : (uint64_t)p->lo;
+}
+
+static uint64_t
+__nodelist_stable_output_key(
+    const void                      *elem,
+    int                             word
+)
+{
+    const nodelist_stable_piece_t   *p = elem;
+
+    return word ? (uint64_t)p->order : (uint64_t)p->lo;
+}
+
+/*
+ * Min-heap of piece pointers keyed on their order.
+ */
+static void
+__nodelist_heap_push(
+    const nodelist_stable_piece_t   **heap,
+    size_t                          *heap_len,
+    const nodelist_stable_piece_t   *p
+)
+{
+    size_t                          i = (*heap_len)++;
+
+    while ( i && (heap[(i - 1) / 2]->order > p->order) ) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = p;
+}
+
+static void
+__nodelist_heap_pop(
+    const nodelist_stable_piece_t   **heap,
+    size_t                          *heap_len
+)
+{
+    const nodelist_stable_piece_t   *last = heap[--(*heap_len)];
+    size_t                          i = 0, n = *heap_len;
+
+    while ( 2 * i + 1 < n ) {
+        size_t                      c = 2 * i + 1;
+
+        if ( (c + 1 < n) && (heap[c + 1]->order < heap[c]->order) ) c++;
+        if ( heap[c]->order >= last->order ) break;
+        heap[i] = heap[c];
+        i = c;
+    }
+    if ( n ) heap[i] = last;
+}
+
+void
+nodelist_uniq_stable(
+    nodelist_t      *nl
+)
+{
+    nodelist_stable_piece_t         *pieces, *out;
+    const nodelist_stable_piece_t   **heap;
+    size_t                          n_pieces = 0, n_out = 0, heap_len, i, j;
+
+    if ( nl->range_count < 2 ) return;
+
+    pieces = __nodelist_realloc(NULL, 2 * nl->range_count * sizeof(nodelist_stable_piece_t));
+    for ( i = 0; i < nl->range_count; i++ ) {
+        const nodelist_range_t      *r = &nl->range[i];
+        unsigned long               bound = __nodelist_padded_bound(r->width);
+        nodelist_stable_piece_t     *p = &pieces[n_pieces];
+
+        p->prefix_id = r->prefix_id;
+        p->width = r->width;
+        p->lo = r->lo;
+        p->hi = r->hi;
+        p->order = i;
+        if ( ! r->width ) {
+            p->padded_width = -1;
+            p->lo = p->hi = 0;
+            n_pieces++;
+            continue;
+        }
+        if ( r->lo < bound ) {
+            p->padded_width = r->width;
+            if ( r->hi < bound ) {
+                n_pieces++;
+                continue;
+            }
+            p->hi = bound - 1;
+            pieces[++n_pieces] = *p;
+            p = &pieces[n_pieces];
+            p->lo = bound;
+            p->hi = r->hi;
+        }
+        p->padded_width = 0;
+        n_pieces++;
+    }
+    __nodelist_radix_sort(pieces, n_pieces, sizeof(nodelist_stable_piece_t), 2, __nodelist_stable_piece_key, 1);
+
+    /* Each piece is cut at most once per piece that starts inside it: */
+    out = __nodelist_realloc(NULL, 2 * n_pieces * sizeof(nodelist_stable_piece_t));
+    heap = __nodelist_realloc(NULL, n_pieces * sizeof(nodelist_stable_piece_t*));
+    for ( i = 0; i < n_pieces; i = j ) {
+        unsigned long               x = pieces[i].lo;
+
+        /* Sweep the pieces [i,j) of one prefix and padding class: */
+        heap_len = 0;
+        j = i;
+        while ( (j < n_pieces) && (pieces[j].prefix_id == pieces[i].prefix_id) &&
+                        (pieces[j].padded_width == pieces[i].padded_width) ) j++;
+        for ( size_t k = i; (k < j) || heap_len; ) {
+            unsigned long           end;
+
+            if ( ! heap_len && (pieces[k].lo > x) ) x = pieces[k].lo;
+            while ( (k < j) && (pieces[k].lo <= x) ) __nodelist_heap_push(heap, &heap_len, &pieces[k++]);
+            while ( heap_len && (heap[0]->hi < x) ) __nodelist_heap_pop(heap, &heap_len);
+            if ( ! heap_len ) continue;
+            end = heap[0]->hi;
+            if ( (k < j) && (pieces[k].lo <= end) ) end = pieces[k].lo - 1;
+            out[n_out] = *heap[0];
+            out[n_out].lo = x;
+            out[n_out].hi = end;
+            n_out++;
+            if ( end == heap[0]->hi ) __nodelist_heap_pop(heap, &heap_len);
+            x = end + 1;
+        }
+    }
+    free(heap);
+    free(pieces);
+
+    __nodelist_radix_sort(out, n_out, sizeof(nodelist_stable_piece_t), 2, __nodelist_stable_output_key, 1);
+    nl->range_count = nl->host_count = 0;
+    for ( i = 0; i < n_out; i++ ) {
+        nodelist_range_t            r;
+
+        r.prefix_id = out[i].prefix_id;
+        r.width = out[i].width;
+        r.descending = false;
+        r.lo = out[i].lo;
+        r.hi = out[i].hi;
+        __nodelist_append(nl, &r);
+    }
+    free(out);
+}
+
+//
+
+/*
+ * Explicit sorting.  The ranges are radix-sorted on packed keys -- the
+ * prefix's natural rank, whether the name is numbered, its number and its
+ * width -- in the significance the order calls for.  Ranges that then
+ * overlap within a group (one prefix for the natural order, all numbered
+ * names for the numeric order) are merged host by host over a heap of
+ * their cursors, so only overlapping stretches are ever expanded.
+ */
+static uint64_t
+__nodelist_natural_sort_key(
+    const void                  *elem,
+    int                         word
+)
+{
+    const nodelist_range_sort_t *s = elem;
+
+    switch ( word ) {
+        case 0:     return (uint64_t)s->r.width;
+        case 1:     return (uint64_t)s->r.lo;
+    }
+    return ((uint64_t)s->rank << 1) | (s->r.width != 0);
+}
+
+static uint64_t
+__nodelist_numeric_sort_key(
+    const void                  *elem,
+    int                         word
+)
+{
+    const nodelist_range_sort_t *s = elem;
+
+    switch ( word ) {
+        case 0:     return (uint64_t)s->r.width;
+        case 1:     return (uint64_t)s->rank;
+        case 2:     return (uint64_t)s->r.lo;
+    }
+    return (uint64_t)(s->r.width != 0);
+}
+
+/*
+ * A range being merged:  <num> is its next host.
+ */
+typedef struct {
+    const nodelist_range_sort_t *s;
+    unsigned long               num;
+    size_t                      order;
+} nodelist_sort_cursor_t;
+
+static bool
+__nodelist_sort_cursor_less(
+    const nodelist_sort_cursor_t    *a,
+    const nodelist_sort_cursor_t    *b,
+    nodelist_sort_order             order
+)
+{
+    if ( a->num != b->num ) return a->num < b->num;
+    if ( (order == nodelist_sort_numeric) && (a->s->rank != b->s->rank) ) return a->s->rank < b->s->rank;
+    if ( a->s->r.width != b->s->r.width ) return a->s->r.width < b->s->r.width;
+    return a->order < b->order;
+}
+
+static void
+__nodelist_sort_cursor_sift(
+    nodelist_sort_cursor_t  *heap,
+    size_t                  heap_len,
+    size_t                  i,
+    nodelist_sort_order     order
+)
+{
+    nodelist_sort_cursor_t  c = heap[i];
+
+    while ( 2 * i + 1 < heap_len ) {
+        size_t              child = 2 * i + 1;
+
+        if ( (child + 1 < heap_len) && __nodelist_sort_cursor_less(&heap[child + 1], &heap[child], order) ) child++;
+        if ( ! __nodelist_sort_cursor_less(&heap[child], &c, order) ) break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = c;
+}
+
+static void
+__nodelist_sort_merge(
+    nodelist_t                  *nl,
+    const nodelist_range_sort_t *ranges,
+    size_t                      start,
+    size_t                      end,
+    nodelist_sort_order         order,
+    nodelist_sort_cursor_t      *heap
+)
+{
+    size_t                      heap_len = end - start, i;
+
+    for ( i = 0; i < heap_len; i++ ) {
+        heap[i].s = &ranges[start + i];
+        heap[i].num = ranges[start + i].r.lo;
+        heap[i].order = i;
+    }
+    for ( i = heap_len / 2; i-- > 0; ) __nodelist_sort_cursor_sift(heap, heap_len, i, order);
+    while ( heap_len ) {
+        nodelist_sort_cursor_t  *top = &heap[0];
+        nodelist_range_t        r = top->s->r;
+        size_t                  next = 0;
+
+        /* The top runs on until it reaches the smaller of its children: */
+        if ( heap_len > 1 ) next = 1;
+        if ( (heap_len > 2) && __nodelist_sort_cursor_less(&heap[2], &heap[1], order) ) next = 2;
+        r.lo = top->num;
+        if ( next && (heap[next].num <= r.hi) ) r.hi = (heap[next].num > r.lo) ? heap[next].num - 1 : r.lo;
+        __nodelist_append(nl, &r);
+        if ( r.hi == top->s->r.hi ) {
+            heap[0] = heap[--heap_len];
+        } else {
+            top->num = r.hi + 1;
+        }
+        if ( heap_len ) __nodelist_sort_cursor_sift(heap, heap_len, 0, order);
+    }
+}
+
+void
+nodelist_sort(
+    nodelist_t              *nl,
+    nodelist_sort_order     order,
+    unsigned                threads
+)
+{
+    nodelist_range_sort_t   *ranges;
+    nodelist_sort_cursor_t  *heap;
+    unsigned                *rank;
+    size_t                  n = nl->range_count, i, j;
+
+    if ( (order == nodelist_sort_input) || (n < 1) ) return;
+
+    rank = __nodelist_prefix_ranks(nl);
+    ranges = __nodelist_realloc(NULL, n * sizeof(nodelist_range_sort_t));
+    for ( i = 0; i < n; i++ ) {
+        ranges[i].rank = rank[nl->range[i].prefix_id];
+        ranges[i].r = nl->range[i];
+        ranges[i].r.descending = false;
+    }
+    free(rank);
+    if ( order == nodelist_sort_numeric ) {
+        __nodelist_radix_sort(ranges, n, sizeof(nodelist_range_sort_t), 4, __nodelist_numeric_sort_key, threads);
+    } else {
+        __nodelist_radix_sort(ranges, n, sizeof(nodelist_range_sort_t), 3, __nodelist_natural_sort_key, threads);
+    }
+
+    nl->range_count = nl->host_count = 0;
+    heap = NULL;
+    for ( i = 0; i < n; i = j ) {
+        unsigned long       hi = ranges[i].r.hi;
+
+        /* Find the ranges overlapping ranges[i] (single names never do): */
+        j = i + 1;
+        if ( ranges[i].r.width ) {
+            while ( (j < n) && ranges[j].r.width && (ranges[j].r.lo <= hi) &&
+                        ((order == nodelist_sort_numeric) || (ranges[j].rank == ranges[i].rank)) ) {
+                if ( ranges[j].r.hi > hi ) hi = ranges[j].r.hi;
+                j++;
+            }
+        }
+        if ( j == i + 1 ) {
+            __nodelist_append(nl, &ranges[i].r);
+        } else {
+            if ( ! heap ) heap = __nodelist_realloc(NULL, n * sizeof(nodelist_sort_cursor_t));
+            __nodelist_sort_merge(nl, ranges, i, j, order, heap);
+        }
+    }
+    if ( heap ) free(heap);
+    free(ranges);
+
+    if ( order == nodelist_sort_reverse ) {
+        /* The natural order turned around, each range walked downwards: */
+        for ( i = 0, j = nl->range_count; i < j; i++ ) {
+            nodelist_range_t    r = nl->range[i];
+
+            nl->range[i] = nl->range[--j];
+            nl->range[i].descending = true;
+            if ( i < j ) {
+                nl->range[j] = r;
+                nl->range[j].descending = true;
+            }
+        }
+    }
+}
+
+typedef struct {
+    unsigned        prefix_id;
+    int             padded_width;
+    unsigned long   lo, hi;
+} nodelist_index_entry_t;
+
+static int
+__nodelist_index_entry_cmp(
+    const void      *a,
+    const void      *b
+)
+{
+    const nodelist_index_entry_t  *A = a, *B = b;
+
+    if ( A->prefix_id != B->prefix_id ) return (A->prefix_id < B->prefix_id) ? -1 : 1;
+    if ( A->padded_width != B->padded_width ) return A->padded_width - B->padded_width;
+    if ( A->lo != B->lo ) return (A->lo < B->lo) ? -1 : 1;
+    return 0;
+}
+
+nodelist_index_t*
+nodelist_index_create(
+    const nodelist_t    *nl
+)
+{
+    nodelist_index_t        *idx = __nodelist_realloc(NULL, sizeof(nodelist_index_t));
+    nodelist_index_entry_t  *entry = NULL;
+    size_t                  n_entry = 0, i;
+
+    idx->nl = nl;
+    idx->single = calloc(nl->prefix_count + 1, sizeof(bool));
+    idx->group_start = calloc(nl->prefix_count + 1, sizeof(size_t));
+    if ( ! idx->single || ! idx->group_start ) {
+        fprintf(stderr, "FATAL:  unable to allocate memory for node list index\n");
+        exit(ENOMEM);
+    }
+    idx->group = NULL;
+    idx->group_count = 0;
+    idx->interval = NULL;
+    idx->interval_count = 0;
+
+    /* Split every range at its padding boundary: */
+    if ( nl->range_count ) entry = __nodelist_realloc(NULL, 2 * nl->range_count * sizeof(nodelist_index_entry_t));
+    for ( i = 0; i < nl->range_count; i++ ) {
+        const nodelist_range_t  *r = &nl->range[i];
+        unsigned long           bound = __nodelist_padded_bound(r->width);
+
+        if ( ! r->width ) {
+            idx->single[r->prefix_id] = true;
+            continue;
+        }
+        if ( r->lo < bound ) {
+            entry[n_entry].prefix_id = r->prefix_id;
+            entry[n_entry].padded_width = r->width;
+            entry[n_entry].lo = r->lo;
+            entry[n_entry].hi = (r->hi < bound) ? r->hi : (bound - 1);
+            n_entry++;
+        }
+        if ( r->hi >= bound ) {
+            entry[n_entry].prefix_id = r->prefix_id;
+            entry[n_entry].padded_width = 0;
+            entry[n_entry].lo = (r->lo > bound) ? r->lo : bound;
+            entry[n_entry].hi = r->hi;
+            n_entry++;
+        }
+    }
+    if ( n_entry ) {
+        qsort(entry, n_entry, sizeof(nodelist_index_entry_t), __nodelist_index_entry_cmp);
+        idx->interval = __nodelist_realloc(NULL, n_entry * sizeof(nodelist_interval_t));
+        idx->group = __nodelist_realloc(NULL, n_entry * sizeof(nodelist_index_group_t));
+    }
+
+    /* Coalesce overlapping and adjacent intervals within each group, and
+     * count the groups belonging to each prefix:
+     */
+    for ( i = 0; i < n_entry; i++ ) {
+        const nodelist_index_entry_t  *e = &entry[i];
+
+        if ( i && (e->prefix_id == entry[i - 1].prefix_id) && (e->padded_width == entry[i - 1].padded_width) ) {
+            nodelist_interval_t       *last = &idx->interval[idx->interval_count - 1];
+
+            if ( e->lo <= last->hi + 1 ) {
+                if ( e->hi > last->hi ) last->hi = e->hi;
+                continue;
+            }
+        } else {
+            nodelist_index_group_t    *g = &idx->group[idx->group_count++];
+
+            g->padded_width = e->padded_width;
+            g->start = idx->interval_count;
+            g->count = 0;
+            idx->group_start[e->prefix_id + 1]++;
+        }
+        idx->interval[idx->interval_count].lo = e->lo;
+        idx->interval[idx->interval_count].hi = e->hi;
+        idx->interval_count++;
+        idx->group[idx->group_count - 1].count++;
+    }
+    for ( i = 0; i < nl->prefix_count; i++ ) idx->group_start[i + 1] += idx->group_start[i];
+    if ( entry ) free(entry);
+    return idx;
+}
+
+//
+
+void
+nodelist_index_destroy(
+    nodelist_index_t    *idx
+)
+{
+    if ( idx ) {
+        free(idx->single);
+        free(idx->group_start);
+        if ( idx->group ) free(idx->group);
+        if ( idx->interval ) free(idx->interval);
+        free(idx);
+    }
+}
+
+//
+
+static const nodelist_index_group_t*
+__nodelist_index_group(
+    const nodelist_index_t  *idx,
+    unsigned                prefix_id,
+    int                     padded_width
+)
+{
+    size_t                  g;
+
+    for ( g = idx->group_start[prefix_id]; g < idx->group_start[prefix_id + 1]; g++ ) {
+        if ( idx->group[g].padded_width == padded_width ) return &idx->group[g];
+    }
+    return NULL;
+}
+
+/*
+ * Position of the first interval in the group whose hi is >= num.
+ */
+static size_t
+__nodelist_index_search(
+    const nodelist_index_t          *idx,
+    const nodelist_index_group_t    *g,
+    unsigned long                   num
+)
+{
+    const nodelist_interval_t       *iv = idx->interval + g->start;
+    size_t                          lo = 0, hi = g->count;
+
+    while ( lo < hi ) {
+        size_t                      mid = lo + (hi - lo) / 2;
+
+        if ( iv[mid].hi < num ) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+bool
+nodelist_index_find(
+    const nodelist_index_t  *idx,
+    const char              *host,
+    size_t                  host_len
+)
+{
+    nodelist_hostname_t             hn;
+    const nodelist_index_group_t    *g;
+    int                             id;
+    size_t                          k;
+
+    __nodelist_hostname_parse(host, host_len, &hn);
+    id = __nodelist_prefix_lookup(idx->nl, hn.prefix, hn.prefix_len);
+    if ( id < 0 ) return false;
+    if ( ! hn.width ) return idx->single[id];
+
+    g = __nodelist_index_group(idx, id, (hn.num < __nodelist_padded_bound(hn.width)) ? hn.width : 0);
+    if ( ! g ) return false;
+    k = __nodelist_index_search(idx, g, hn.num);
+    return (k < g->count) && (idx->interval[g->start + k].lo <= hn.num);
+}
+
+//
+
+/*
+ * Append the parts of [lo,hi] of range r that are not covered by the
+ * group's intervals.
+ */
+static void
+__nodelist_exclude_span(
+    nodelist_t                      *nl,
+    const nodelist_range_t          *r,
+    unsigned long                   lo,
+    unsigned long                   hi,
+    const nodelist_index_t          *idx,
+    const nodelist_index_group_t    *g
+)
+{
+    nodelist_range_t                piece = *r;
+    size_t                          k;
+
+    if ( g ) {
+        for ( k = __nodelist_index_search(idx, g, lo); k < g->count; k++ ) {
+            const nodelist_interval_t   *iv = &idx->interval[g->start + k];
+
+            if ( iv->lo > hi ) break;
+            if ( iv->lo > lo ) {
+                piece.lo = lo;
+                piece.hi = iv->lo - 1;
+                __nodelist_append(nl, &piece);
+            }
+            if ( iv->hi >= hi ) return;
+            lo = iv->hi + 1;
+        }
+    }
+    piece.lo = lo;
+    piece.hi = hi;
+    __nodelist_append(nl, &piece);
+}
+
+void
+nodelist_exclude(
+    nodelist_t              *nl,
+    const nodelist_index_t  *exclusions
+)
+{
+    nodelist_range_t        *in_range = nl->range;
+    size_t                  in_count = nl->range_count, i;
+    int                     *prefix_map;
+
+    if ( ! exclusions || ! nodelist_count(exclusions->nl) || ! in_count ) return;
+
+    /* Translate our prefix ids to the index's once up front: */
+    prefix_map = __nodelist_realloc(NULL, nl->prefix_count * sizeof(int));
+    for ( i = 0; i < nl->prefix_count; i++ ) {
+        prefix_map[i] = __nodelist_prefix_lookup(exclusions->nl, nl->prefix[i].str, nl->prefix[i].len);
+    }
+
+    nl->range = NULL;
+    nl->range_count = nl->range_capacity = 0;
+    nl->host_count = 0;
+
+    for ( i = 0; i < in_count; i++ ) {
+        const nodelist_range_t  *r = &in_range[i];
+        int                     id = prefix_map[r->prefix_id];
+        unsigned long           bound;
+
+        if ( id < 0 ) {
+            __nodelist_append(nl, r);
+        } else if ( ! r->width ) {
+            if ( ! exclusions->single[id] ) __nodelist_append(nl, r);
+        } else {
+            bound = __nodelist_padded_bound(r->width);
+            if ( r->lo < bound ) {
+                __nodelist_exclude_span(nl, r, r->lo, (r->hi < bound) ? r->hi : (bound - 1),
+                        exclusions, __nodelist_index_group(exclusions, id, r->width));
+            }
+            if ( r->hi >= bound ) {
+                __nodelist_exclude_span(nl, r, (r->lo > bound) ? r->lo : bound, r->hi,
+                        exclusions, __nodelist_index_group(exclusions, id, 0));
+            }
+        }
+    }
+    free(prefix_map);
+    free(in_range);
+}
+
+//
+
+static inline bool
+__nodelist_set_keep(
+    nodelist_set_op     op,
+    bool                in_a,
+    bool                in_b
+)
+{
+    switch ( op ) {
+        case nodelist_set_union:
+            return in_a || in_b;
+        case nodelist_set_intersect:
+            return in_a && in_b;
+        case nodelist_set_minus:
+            return in_a && ! in_b;
+        case nodelist_set_xor:
+            return in_a != in_b;
+        default:
+            return false;
+    }
+}
+
+/*
+ * Sweep two sorted, coalesced interval sets together:  each step covers
+ * the longest span over which membership in both sets is constant, and
+ * the span is kept or dropped as the operation dictates.
+ */
+static void
+__nodelist_combine_intervals(
+    nodelist_t                  *result,
+    nodelist_range_t            *r,
+    const nodelist_interval_t   *a,
+    size_t                      a_count,
+    const nodelist_interval_t   *b,
+    size_t                      b_count,
+    nodelist_set_op             op
+)
+{
+    unsigned long               next = 0;
+    size_t                      i = 0, j = 0;
+
+    while ( (i < a_count) || (j < b_count) ) {
+        unsigned long           a_lo = ULONG_MAX, b_lo = ULONG_MAX, lo, hi;
+        bool                    in_a, in_b;
+
+        if ( i < a_count ) a_lo = (a[i].lo > next) ? a[i].lo : next;
+        if ( j < b_count ) b_lo = (b[j].lo > next) ? b[j].lo : next;
+        lo = (a_lo < b_lo) ? a_lo : b_lo;
+        in_a = (i < a_count) && (a_lo == lo);
+        in_b = (j < b_count) && (b_lo == lo);
+
+        hi = ULONG_MAX;
+        if ( in_a ) hi = a[i].hi;
+        else if ( i < a_count ) hi = a_lo - 1;
+        if ( in_b ) {
+            if ( b[j].hi < hi ) hi = b[j].hi;
+        } else if ( (j < b_count) && (b_lo - 1 < hi) ) {
+            hi = b_lo - 1;
+        }
+
+        if ( __nodelist_set_keep(op, in_a, in_b) ) {
+            r->lo = lo;
+            r->hi = hi;
+            __nodelist_append(result, r);
+        }
+        if ( in_a && (a[i].hi == hi) ) i++;
+        if ( in_b && (b[j].hi == hi) ) j++;
+        next = hi + 1;
+    }
+}
+
+/*
+ * Combine everything one prefix holds in the two indexes; a prefix id of
+ * -1 means that index does not know the prefix.
+ */
+static void
+__nodelist_combine_prefix(
+    nodelist_t              *result,
+    const nodelist_index_t  *a,
+    int                     a_id,
+    const nodelist_index_t  *b,
+    int                     b_id,
+    nodelist_set_op         op
+)
+{
+    const nodelist_prefix_t *p = (a_id >= 0) ? &a->nl->prefix[a_id] : &b->nl->prefix[b_id];
+    nodelist_range_t        r;
+    size_t                  ga = 0, ga_end = 0, gb = 0, gb_end = 0;
+
+    r.prefix_id = __nodelist_prefix_intern(result, p->str, p->len);
+    r.descending = false;
+    if ( __nodelist_set_keep(op, (a_id >= 0) && a->single[a_id], (b_id >= 0) && b->single[b_id]) ) {
+        r.width = 0;
+        r.lo = r.hi = 0;
+        __nodelist_append(result, &r);
+    }
+
+    /* Groups are sorted by padded width, so they pair up by merging: */
+    if ( a_id >= 0 ) ga = a->group_start[a_id], ga_end = a->group_start[a_id + 1];
+    if ( b_id >= 0 ) gb = b->group_start[b_id], gb_end = b->group_start[b_id + 1];
+    while ( (ga < ga_end) || (gb < gb_end) ) {
+        const nodelist_index_group_t  *g_a = NULL, *g_b = NULL;
+
+        if ( (ga < ga_end) && ((gb == gb_end) || (a->group[ga].padded_width <= b->group[gb].padded_width)) ) {
+            g_a = &a->group[ga++];
+        }
+        if ( (gb < gb_end) && (! g_a || (b->group[gb].padded_width == g_a->padded_width)) ) {
+            g_b = &b->group[gb++];
+        }
+        r.width = g_a ? g_a->padded_width : g_b->padded_width;
+        if ( ! r.width ) r.width = 1;
+        __nodelist_combine_intervals(result, &r,
+                g_a ? a->interval + g_a->start : NULL, g_a ? g_a->count : 0,
+                g_b ? b->interval + g_b->start : NULL, g_b ? g_b->count : 0,
+                op);
+    }
+}
+
+void
+nodelist_combine(
+    nodelist_t          *nl,
+    const nodelist_t    *other,
+    nodelist_set_op     op
+)
+{
+    nodelist_index_t    *a = nodelist_index_create(nl);
+    nodelist_index_t    *b = nodelist_index_create(other);
+    nodelist_t          *result = nodelist_create();
+    unsigned            i;
+
+    for ( i = 0; i < nl->prefix_count; i++ ) {
+        __nodelist_combine_prefix(result, a, i,
+                b, __nodelist_prefix_lookup(other, nl->prefix[i].str, nl->prefix[i].len), op);
+    }
+    for ( i = 0; i < other->prefix_count; i++ ) {
+        if ( __nodelist_prefix_lookup(nl, other->prefix[i].str, other->prefix[i].len) < 0 ) {
+            __nodelist_combine_prefix(result, a, -1, b, i, op);
+        }
+    }
+    nodelist_index_destroy(a);
+    nodelist_index_destroy(b);
+
+    /* The result takes the place of nl's tables: */
+    for ( i = 0; i < nl->prefix_count; i++ ) free(nl->prefix[i].str);
+    free(nl->prefix);
+    free(nl->prefix_hash);
+    free(nl->range);
+    result->partial = nl->partial;
+    *nl = *result;
+    free(result);
+    nodelist_uniq(nl);
+}
+
+//
+
+void
+nodelist_slice(
+    nodelist_t          *nl,
+    size_t              start,
+    size_t              end
+)
+{
+    size_t              first = 0, n_out = 0, i;
+
+    if ( end > nl->host_count ) end = nl->host_count;
+    if ( start >= end ) {
+        nl->range_count = nl->host_count = 0;
+        return;
+    }
+
+    /* first is the index of range i's first host: */
+    for ( i = 0; (i < nl->range_count) && (first < end); i++ ) {
+        nodelist_range_t    r = nl->range[i];
+        size_t              len = nodelist_range_count(&r);
+
+        if ( first + len > start ) {
+            __nodelist_range_trim(&r, (start > first) ? start - first : 0, (first + len > end) ? end - first : len);
+            nl->range[n_out++] = r;
+        }
+        first += len;
+    }
+    nl->range_count = n_out;
+    nl->host_count = end - start;
+}
+
+//
+
+void
+nodelist_split_init(
+    nodelist_split_t    *split,
+    const nodelist_t    *nl
+)
+{
+    split->nl = nl;
+    split->range_idx = 0;
+    split->offset = 0;
+    split->piece = *nl;
+    split->piece.range = NULL;
+    split->piece.range_count = split->piece.range_capacity = 0;
+    split->piece.host_count = 0;
+}
+
+const nodelist_t*
+nodelist_split_next(
+    nodelist_split_t    *split,
+    size_t              count
+)
+{
+    const nodelist_t    *nl = split->nl;
+    nodelist_t          *piece = &split->piece;
+
+    piece->range_count = piece->host_count = 0;
+    while ( count && (split->range_idx < nl->range_count) ) {
+        nodelist_range_t    r = nl->range[split->range_idx];
+        size_t              left = nodelist_range_count(&r) - split->offset;
+
+        if ( piece->range_count == piece->range_capacity ) {
+            piece->range_capacity = piece->range_capacity ? 2 * piece->range_capacity : 64;
+            piece->range = __nodelist_realloc(piece->range, piece->range_capacity * sizeof(nodelist_range_t));
+        }
+        if ( count < left ) left = count;
+        __nodelist_range_trim(&r, split->offset, split->offset + left);
+        split->offset += left;
+        if ( split->offset == nodelist_range_count(&nl->range[split->range_idx]) ) {
+            split->range_idx++;
+            split->offset = 0;
+        }
+        piece->range[piece->range_count++] = r;
+        piece->host_count += left;
+        count -= left;
+    }
+    return piece;
+}
+
+void
+nodelist_split_destroy(
+    nodelist_split_t    *split
+)
+{
+    if ( split->piece.range ) free(split->piece.range);
+    split->piece.range = NULL;
+}
+
+//
+
+void
+nodelist_locator_init(
+    nodelist_locator_t  *loc,
+    const nodelist_t    *nl
+)
+{
+    size_t              i, first = 0;
+
+    loc->nl = nl;
+    loc->first = __nodelist_realloc(NULL, (nl->range_count ? nl->range_count : 1) * sizeof(size_t));
+    for ( i = 0; i < nl->range_count; i++ ) {
+        loc->first[i] = first;
+        first += nodelist_range_count(&nl->range[i]);
+    }
+}
+
+void
+nodelist_locator_destroy(
+    nodelist_locator_t  *loc
+)
+{
+    if ( loc->first ) free(loc->first);
+    loc->first = NULL;
+}
+
+/*
+ * Index of the range holding host <position>.
+ */
+static size_t
+__nodelist_locate(
+    const nodelist_locator_t    *loc,
+    size_t                      position
+)
+{
+    size_t                      lo = 0, hi = loc->nl->range_count;
+
+    while ( hi - lo > 1 ) {
+        size_t                  mid = lo + (hi - lo) / 2;
+
+        if ( loc->first[mid] <= position ) lo = mid;
+        else hi = mid;
+    }
+    return lo;
+}
+
+size_t
+nodelist_locator_render(
+    const nodelist_locator_t    *loc,
+    size_t                      position,
+    char                        *buf
+)
+{
+    size_t                      i = __nodelist_locate(loc, position);
+    const nodelist_range_t      *r = &loc->nl->range[i];
+
+    return nodelist_render_host(loc->nl, r, __nodelist_range_num(r, position - loc->first[i]), buf);
+}
+
+void
+nodelist_locator_append(
+    const nodelist_locator_t    *loc,
+    nodelist_t                  *nl,
+    size_t                      start,
+    size_t                      end
+)
+{
+    const nodelist_t            *src = loc->nl;
+    size_t                      i;
+
+    if ( end > src->host_count ) end = src->host_count;
+    if ( start >= end ) return;
+    for ( i = __nodelist_locate(loc, start); start < end; i++ ) {
+        nodelist_range_t        r = src->range[i];
+        const nodelist_prefix_t *p = &src->prefix[r.prefix_id];
+        size_t                  offset = start - loc->first[i];
+        size_t                  take = nodelist_range_count(&r) - offset;
+
+        if ( take > end - start ) take = end - start;
+        __nodelist_range_trim(&r, offset, offset + take);
+        r.prefix_id = __nodelist_prefix_intern(nl, p->str, p->len);
+        __nodelist_append(nl, &r);
+        start += take;
+    }
+}
+
+//
+
+bool
+nodelist_position(
+    const nodelist_t    *nl,
+    const char          *host,
+    size_t              host_len,
+    size_t              *position
+)
+{
+    nodelist_hostname_t hn;
+    int                 id, padded_width = 0;
+    size_t              first = 0, i;
+
+    __nodelist_hostname_parse(host, host_len, &hn);
+    id = __nodelist_prefix_lookup(nl, hn.prefix, hn.prefix_len);
+    if ( id < 0 ) return false;
+    if ( hn.width && (hn.num < __nodelist_padded_bound(hn.width)) ) padded_width = hn.width;
+
+    for ( i = 0; i < nl->range_count; i++ ) {
+        const nodelist_range_t  *r = &nl->range[i];
+
+        if ( r->prefix_id == (unsigned)id ) {
+            if ( ! r->width ) {
+                if ( ! hn.width ) {
+                    *position = first;
+                    return true;
+                }
+            } else if ( hn.width && (r->lo <= hn.num) && (hn.num <= r->hi) ) {
+                /* The range must print the number the same way: */
+                if ( ((hn.num < __nodelist_padded_bound(r->width)) ? r->width : 0) == padded_width ) {
+                    *position = first + __nodelist_range_offset(r, hn.num);
+                    return true;
+                }
+            }
+        }
+        first += nodelist_range_count(r);
+    }
+    return false;
+}
+
+//
+
+/*
+ * Slurm's _get_bracketed_list() rules:  successive numbered ranges with the
+ * same prefix share one set of brackets, which are needed whenever there
+ * is more than one number to show.
+ */
+static inline bool
+__nodelist_within_range(
+    const nodelist_range_t  *r1,
+    const nodelist_range_t  *r2
+)
+{
+    return (r1->prefix_id == r2->prefix_id) && r1->width && r2->width;
+}
+
+static size_t
+__nodelist_ranged_string_walk(
+    const nodelist_t    *nl,
+    char                *buf
+)
+{
+    size_t              len = 0, i = 0;
+
+    while ( i < nl->range_count ) {
+        const nodelist_range_t  *r = &nl->range[i];
+        const nodelist_prefix_t *p = &nl->prefix[r->prefix_id];
+        bool                    brackets = (r->hi > r->lo) ||
+                                    ((i + 1 < nl->range_count) && __nodelist_within_range(r, r + 1));
+        size_t                  start = i;
+
+        if ( i ) {
+            if ( buf ) buf[len] = ',';
+            len++;
+        }
+        if ( buf ) memcpy(buf + len, p->str, p->len);
+        len += p->len;
+        if ( brackets ) {
+            if ( buf ) buf[len] = '[';
+            len++;
+        }
+        do {
+            r = &nl->range[i];
+            if ( i > start ) {
+                if ( buf ) buf[len] = ',';
+                len++;
+            }
+            if ( r->width && r->descending ) {
+                /* A range is written lo-hi, so descending hosts are listed one by one: */
+                unsigned long   num = r->hi;
+
+                while ( 1 ) {
+                    if ( buf ) len += __nodelist_format_num(buf + len, num, r->width);
+                    else len += __nodelist_num_len(num, r->width);
+                    if ( num-- == r->lo ) break;
+                    if ( buf ) buf[len] = ',';
+                    len++;
+                }
+            } else if ( r->width ) {
+                if ( buf ) {
+                    len += __nodelist_format_num(buf + len, r->lo, r->width);
+                    if ( r->hi > r->lo ) {
+                        buf[len++] = '-';
+                        len += __nodelist_format_num(buf + len, r->hi, r->width);
+                    }
+                } else {
+                    len += __nodelist_num_len(r->lo, r->width);
+                    if ( r->hi > r->lo ) len += 1 + __nodelist_num_len(r->hi, r->width);
+                }
+            }
+        } while ( (++i < nl->range_count) && __nodelist_within_range(&nl->range[i], &nl->range[i - 1]) );
+        if ( brackets ) {
+            if ( buf ) buf[len] = ']';
+            len++;
+        }
+    }
+    return len;
+}
+
+size_t
+nodelist_ranged_string_len(
+    const nodelist_t    *nl
+)
+{
+    return __nodelist_ranged_string_walk(nl, NULL);
+}
+
+char*
+nodelist_ranged_string(
+    const nodelist_t    *nl
+)
+{
+    size_t              len = __nodelist_ranged_string_walk(nl, NULL);
+    char                *buf = __nodelist_realloc(NULL, len + 1);
+
+    __nodelist_ranged_string_walk(nl, buf);
+    buf[len] = '\0';
+    return buf;
+}
+
+//
+
+size_t
+nodelist_host_len_max(
+    const nodelist_t    *nl
+)
+{
+    return nl->prefix_len_max + NODELIST_MAX_DIGITS;
+}
+
+//
+
+size_t
+nodelist_render_host(
+    const nodelist_t        *nl,
+    const nodelist_range_t  *r,
+    unsigned long           num,
+    char                    *buf
+)
+{
+    const nodelist_prefix_t *p = &nl->prefix[r->prefix_id];
+    size_t                  len = p->len;
+
+    memcpy(buf, p->str, len);
+    if ( r->width ) len += __nodelist_format_num(buf + len, num, r->width);
+    buf[len] = '\0';
+    return len;
+}
+
+//
+
+bool
+nodelist_expand(
+    const nodelist_t    *nl,
+    const char          *delimiter,
+    size_t              delimiter_len,
+    output_t            *out
+)
+{
+    char                *host = __nodelist_realloc(NULL, nodelist_host_len_max(nl) + 1);
+    bool                first = true, ok = true;
+    size_t              i;
+
+    for ( i = 0; ok && (i < nl->range_count); i++ ) {
+        const nodelist_range_t  *r = &nl->range[i];
+        size_t                  digits_start = nl->prefix[r->prefix_id].len;
+        unsigned long           num = __nodelist_range_num(r, 0);
+        size_t                  host_len = nodelist_render_host(nl, r, num, host);
+
+        while ( 1 ) {
+            if ( first ) {
+                first = false;
+            } else {
+                output_write(out, delimiter, delimiter_len);
+            }
+            ok = output_write(out, host, host_len);
+            if ( (num == (r->descending ? r->lo : r->hi)) || ! ok ) break;
+
+            /* Step the rendered digits; only a carry out of the leftmost
+             * digit (e.g. 99 -> 100), or a borrow that zeroes it (100 -> 99),
+             * needs the name to be re-rendered:
+             */
+            if ( r->descending ) {
+                char    *p = host + host_len - 1;
+
+                num--;
+                while ( *p == '0' ) *p-- = '9';
+                if ( (--(*p) == '0') && (p == host + digits_start) && (host_len - digits_start > 1) ) {
+                    host_len = nodelist_render_host(nl, r, num, host);
+                }
+            } else {
+                char    *p = host + host_len - 1;
+
+                num++;
+                while ( (p >= host + digits_start) && (*p == '9') ) *p-- = '0';
+                if ( p >= host + digits_start ) {
+                    (*p)++;
+                } else {
+                    host_len = nodelist_render_host(nl, r, num, host);
+                }
+            }
+        }
+    }
+    free(host);
+    return ok;
+}
+
+/*
+ * Threaded expansion.  The list is cut into slices of a fixed number of
+ * hosts; workers claim slices in order and render each into the buffer of
+ * a ring slot, while this thread writes the finished buffers to <out> in
+ * slice order.  A worker waits for its slot to be written before it
+ * reuses it, so memory stays bounded at one buffer per slot.
+ */
+#define NODELIST_EXPAND_SLICE_HOSTS     (256 * 1024)
+
+typedef struct {
+    const char          *delimiter;
+    size_t              delimiter_len;
+    nodelist_t          *slice;         /* views sharing the list's prefixes */
+    size_t              slice_count;
+    output_t            **buffer;       /* per slot */
+    bool                *ready;         /* per slot */
+    unsigned            slot_count;
+    size_t              next_slice, written;
+    pthread_mutex_t     lock;
+    pthread_cond_t      cond;
+} nodelist_expand_work_t;
+
+static void*
+__nodelist_expand_worker(
+    void                    *arg
+)
+{
+    nodelist_expand_work_t  *work = arg;
+
+    pthread_mutex_lock(&work->lock);
+    while ( work->next_slice < work->slice_count ) {
+        size_t              k = work->next_slice++;
+        unsigned            slot = k % work->slot_count;
+
+        while ( k >= work->written + work->slot_count ) pthread_cond_wait(&work->cond, &work->lock);
+        pthread_mutex_unlock(&work->lock);
+
+        nodelist_expand(&work->slice[k], work->delimiter, work->delimiter_len, work->buffer[slot]);
+
+        pthread_mutex_lock(&work->lock);
+        work->ready[slot] = true;
+        pthread_cond_broadcast(&work->cond);
+    }
+    pthread_mutex_unlock(&work->lock);
+    return NULL;
+}
+
+bool
+nodelist_expand_threaded(
+    const nodelist_t        *nl,
+    const char              *delimiter,
+    size_t                  delimiter_len,
+    output_t                *out,
+    unsigned                threads
+)
+{
+    nodelist_expand_work_t  work;
+    nodelist_split_t        split;
+    pthread_t               *thread;
+    unsigned                i, started = 0;
+    size_t                  k;
+
+    if ( (threads < 2) || (nl->host_count < 2 * NODELIST_EXPAND_SLICE_HOSTS) ) {
+        return nodelist_expand(nl, delimiter, delimiter_len, out);
+    }
+
+    work.delimiter = delimiter;
+    work.delimiter_len = delimiter_len;
+    work.slice_count = (nl->host_count + NODELIST_EXPAND_SLICE_HOSTS - 1) / NODELIST_EXPAND_SLICE_HOSTS;
+    work.slice = __nodelist_realloc(NULL, work.slice_count * sizeof(nodelist_t));
+    nodelist_split_init(&split, nl);
+    for ( k = 0; k < work.slice_count; k++ ) {
+        const nodelist_t    *piece = nodelist_split_next(&split, NODELIST_EXPAND_SLICE_HOSTS);
+
+        work.slice[k] = *piece;
+        work.slice[k].range = __nodelist_realloc(NULL, piece->range_count * sizeof(nodelist_range_t));
+        memcpy(work.slice[k].range, piece->range, piece->range_count * sizeof(nodelist_range_t));
+        work.slice[k].range_capacity = piece->range_count;
+    }
+    nodelist_split_destroy(&split);
+
+    work.slot_count = 2 * threads;
+    work.buffer = __nodelist_realloc(NULL, work.slot_count * sizeof(output_t*));
+    work.ready = __nodelist_realloc(NULL, work.slot_count * sizeof(bool));
+    for ( i = 0; i < work.slot_count; i++ ) {
+        work.buffer[i] = output_create_buffer();
+        work.ready[i] = false;
+    }
+    work.next_slice = work.written = 0;
+    pthread_mutex_init(&work.lock, NULL);
+    pthread_cond_init(&work.cond, NULL);
+
+    thread = __nodelist_realloc(NULL, threads * sizeof(pthread_t));
+    while ( (started < threads) && (pthread_create(&thread[started], NULL, __nodelist_expand_worker, &work) == 0) ) started++;
+    if ( ! started ) {
+        /* Not even one worker:  this thread renders each slice itself */
+        for ( k = 0; k < work.slice_count; k++ ) {
+            if ( k ) output_write(out, delimiter, delimiter_len);
+            nodelist_expand(&work.slice[k], delimiter, delimiter_len, out);
+        }
+    }
+    for ( k = 0; started && (k < work.slice_count); k++ ) {
+        unsigned            slot = k % work.slot_count;
+
+        pthread_mutex_lock(&work.lock);
+        while ( ! work.ready[slot] ) pthread_cond_wait(&work.cond, &work.lock);
+        pthread_mutex_unlock(&work.lock);
+
+        if ( k ) output_write(out, delimiter, delimiter_len);
+        output_append(out, work.buffer[slot]);
+        output_clear(work.buffer[slot]);
+
+        pthread_mutex_lock(&work.lock);
+        work.ready[slot] = false;
+        work.written++;
+        pthread_cond_broadcast(&work.cond);
+        pthread_mutex_unlock(&work.lock);
+    }
+    for ( i = 0; i < started; i++ ) pthread_join(thread[i], NULL);
+    free(thread);
+
+    pthread_cond_destroy(&work.cond);
+    pthread_mutex_destroy(&work.lock);
+    for ( i = 0; i < work.slot_count; i++ ) output_destroy(work.buffer[i]);
+    free(work.buffer);
+    free(work.ready);
+    for ( k = 0; k < work.slice_count; k++ ) free(work.slice[k].range);
+    free(work.slice);
+    return out->ok;
+}
+
+//
+
+void
+nodelist_iter_init(
+    nodelist_iter_t     *it,
+    const nodelist_t    *nl
+)
+{
+    it->nl = nl;
+    it->range_idx = 0;
+    it->num = nl->range_count ? __nodelist_range_num(&nl->range[0], 0) : 0;
+    it->position = 0;
+    it->buffer = __nodelist_realloc(NULL, nodelist_host_len_max(nl) + 1);
+}
+
+const char*
+nodelist_iter_next(
+    nodelist_iter_t     *it,
+    size_t              *host_len
+)
+{
+    const nodelist_range_t  *r;
+    size_t                  len;
+
+    if ( it->range_idx >= it->nl->range_count ) return NULL;
+    r = &it->nl->range[it->range_idx];
+    len = nodelist_render_host(it->nl, r, it->num, it->buffer);
+    if ( host_len ) *host_len = len;
+    it->prefix = it->nl->prefix[r->prefix_id].str;
+    it->prefix_len = it->nl->prefix[r->prefix_id].len;
+    it->host_num = it->num;
+    it->host_digits = r->width ? (int)(len - it->prefix_len) : 0;
+    it->host_padded_width = (it->num < __nodelist_padded_bound(r->width)) ? r->width : 0;
+    it->position++;
+    if ( it->num == (r->descending ? r->lo : r->hi) ) {
+        if ( ++it->range_idx < it->nl->range_count ) it->num = __nodelist_range_num(&it->nl->range[it->range_idx], 0);
+    } else if ( r->descending ) {
+        it->num--;
+    } else {
+        it->num++;
+    }
+    return it->buffer;
+}
+
+void
+nodelist_iter_seek(
+    nodelist_iter_t     *it,
+    size_t              position
+)
+{
+    const nodelist_t    *nl = it->nl;
+
+    if ( position < it->position ) {
+        it->range_idx = 0;
+        it->num = nl->range_count ? __nodelist_range_num(&nl->range[0], 0) : 0;
+        it->position = 0;
+    }
+    while ( it->range_idx < nl->range_count ) {
+        const nodelist_range_t  *r = &nl->range[it->range_idx];
+        size_t                  offset = __nodelist_range_offset(r, it->num);
+        size_t                  left = nodelist_range_count(r) - offset;
+
+        if ( position - it->position < left ) {
+            it->num = __nodelist_range_num(r, offset + (position - it->position));
+            it->position = position;
+            return;
+        }
+        it->position += left;
+        if ( ++it->range_idx < nl->range_count ) it->num = __nodelist_range_num(&nl->range[it->range_idx], 0);
+    }
+}
+
+void
+nodelist_iter_destroy(
+    nodelist_iter_t     *it
+)
+{
+    if ( it->buffer ) free(it->buffer);
+    it->buffer = NULL;
+}
@@ -0,0 +1,309 @@
+/*
+ * nodelist.h
+ *
+ * Native implementation of Slurm host list expressions.
+ *
+ * A nodelist_t holds a host list as a table of numeric ranges:  each
+ * range has an interned prefix, a zero-padded width, and an inclusive
+ * [lo,hi] span of numeric suffixes.  Parsing, expansion, compression,
+ * duplicate removal and exclusion all operate on that table, so their
+ * cost scales with the number of ranges rather than the number of
+ * hosts.
+ *
+ * The semantics follow Slurm's hostlist API (hostlist.c) closely
+ * enough that the output of snodelist is the same with either
+ * backend.
+ *
+ */
+
+#ifndef __NODELIST_H__
+#define __NODELIST_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "output.h"
+
+/*
+ * Numeric suffixes wider than this are not treated as numbers (the
+ * host is then a single name with no range semantics).
+ */
+#define NODELIST_MAX_DIGITS     18
+
+/*
+ * A range lists its hosts from lo up to hi, or from hi down to lo when it
+ * is descending (only nodelist_sort() makes descending ranges).
+ */
+typedef struct {
+    unsigned            prefix_id;
+    short               width;      /* 0 => no numeric suffix, prefix is the full name */
+    bool                descending;
+    unsigned long       lo, hi;
+} nodelist_range_t;
+
+typedef struct {
+    char                *str;
+    size_t              len;
+} nodelist_prefix_t;
+
+typedef struct {
+    nodelist_prefix_t   *prefix;
+    unsigned            prefix_count, prefix_capacity;
+    unsigned            *prefix_hash;       /* open addressing, holds prefix id + 1 */
+    unsigned            prefix_hash_size;
+    size_t              prefix_len_max;
+
+    nodelist_range_t    *range;
+    size_t              range_count, range_capacity;
+    size_t              host_count;
+    bool                partial;
+} nodelist_t;
+
+nodelist_t* nodelist_create(void);
+void nodelist_destroy(nodelist_t *nl);
+
+/*
+ * A partial list never joins a range to the one before it, so appending
+ * it to another list with nodelist_append_list() produces exactly the
+ * ranges that pushing the same expressions onto that list would have.
+ * Partial lists let separate threads parse pieces of the input which are
+ * then merged in input order.
+ */
+nodelist_t* nodelist_create_partial(void);
+void nodelist_append_list(nodelist_t *nl, const nodelist_t *other);
+
+bool nodelist_push(nodelist_t *nl, const char *expr);
+bool nodelist_push_len(nodelist_t *nl, const char *expr, size_t expr_len);
+bool nodelist_push_host(nodelist_t *nl, const char *host, size_t host_len);
+void nodelist_push_range(nodelist_t *nl, const char *prefix, size_t prefix_len,
+            unsigned long lo, unsigned long hi, int width);
+
+static inline size_t
+nodelist_count(
+    const nodelist_t    *nl
+)
+{
+    return nl->host_count;
+}
+
+static inline size_t
+nodelist_range_count(
+    const nodelist_range_t  *r
+)
+{
+    return (size_t)(r->hi - r->lo) + 1;
+}
+
+/*
+ * Sort the list and remove duplicate names as Slurm's hostlist_uniq()
+ * does.
+ */
+void nodelist_uniq(nodelist_t *nl);
+
+/*
+ * Remove duplicate names but keep the first occurrence of each name in
+ * its place, so the list stays in input order.  Works on ranges:  no host
+ * is expanded.
+ */
+void nodelist_uniq_stable(nodelist_t *nl);
+
+/*
+ * Sort the list without removing duplicates:  natural order sorts by
+ * prefix (runs of digits compare numerically) and then number, numeric
+ * order by number and then prefix, and reverse is the natural order
+ * backwards.  The range table is radix-sorted on packed keys using up to
+ * <threads> threads; the reverse order is the natural range table turned
+ * around with each range made descending, so no host is expanded.
+ * Sorting is the last step that reorders a list:  nodelist_exclude() and
+ * nodelist_uniq_stable() expect ascending ranges.
+ */
+typedef enum {
+    nodelist_sort_input     = 0,
+    nodelist_sort_natural   = 1,
+    nodelist_sort_numeric   = 2,
+    nodelist_sort_reverse   = 3
+} nodelist_sort_order;
+
+void nodelist_sort(nodelist_t *nl, nodelist_sort_order order, unsigned threads);
+
+//
+
+/*
+ * Membership index over a host list.  Numbers are split by how they are
+ * printed -- zero-padded to a width, or unpadded -- since two names for
+ * the same number only match when they print the same.  Each prefix
+ * then carries one sorted, coalesced interval set per padded width (and
+ * one for unpadded numbers), so a lookup is a binary search.
+ *
+ * The index refers to the prefix table of the list it was built from,
+ * which must outlive it.
+ */
+typedef struct {
+    unsigned long       lo, hi;
+} nodelist_interval_t;
+
+typedef struct {
+    int                 padded_width;   /* 0 => numbers printed without padding */
+    size_t              start, count;   /* span of the index's interval array */
+} nodelist_index_group_t;
+
+typedef struct {
+    const nodelist_t        *nl;
+    bool                    *single;        /* per prefix:  the bare prefix is a member */
+    size_t                  *group_start;   /* per prefix:  span of the group array */
+    nodelist_index_group_t  *group;
+    size_t                  group_count;
+    nodelist_interval_t     *interval;
+    size_t                  interval_count;
+} nodelist_index_t;
+
+nodelist_index_t* nodelist_index_create(const nodelist_t *nl);
+void nodelist_index_destroy(nodelist_index_t *idx);
+
+bool nodelist_index_find(const nodelist_index_t *idx, const char *host, size_t host_len);
+
+/*
+ * Remove every host present in the index from the list; each range is
+ * cut against the matching interval sets in O(log n) plus the number of
+ * pieces produced.
+ */
+void nodelist_exclude(nodelist_t *nl, const nodelist_index_t *exclusions);
+
+/*
+ * Set operations.  Both lists are reduced to their membership indexes and
+ * the interval sets of each prefix and padding class are merge-walked, so
+ * no host is ever expanded.  The result replaces <nl>, sorted and free of
+ * duplicates as by nodelist_uniq().
+ */
+typedef enum {
+    nodelist_set_none       = 0,
+    nodelist_set_union      = 1,
+    nodelist_set_intersect  = 2,
+    nodelist_set_minus      = 3,
+    nodelist_set_xor        = 4
+} nodelist_set_op;
+
+void nodelist_combine(nodelist_t *nl, const nodelist_t *other, nodelist_set_op op);
+
+/*
+ * Keep only hosts [start,end) of the list (counted from zero, in list
+ * order).  The ranges are walked summing their lengths and the two ranges
+ * holding the boundaries are trimmed, so no host is expanded.
+ */
+void nodelist_slice(nodelist_t *nl, size_t start, size_t end);
+
+/*
+ * Walk a list in consecutive pieces:  each nodelist_split_next() returns
+ * the next <count> hosts (fewer at the end of the list) as a list that
+ * shares <nl>'s prefix table and is valid until the next call.  Ranges
+ * are cut where a piece ends, so no host is expanded.
+ */
+typedef struct {
+    const nodelist_t    *nl;
+    size_t              range_idx;
+    size_t              offset;         /* hosts of range range_idx already returned */
+    nodelist_t          piece;
+} nodelist_split_t;
+
+void nodelist_split_init(nodelist_split_t *split, const nodelist_t *nl);
+const nodelist_t* nodelist_split_next(nodelist_split_t *split, size_t count);
+void nodelist_split_destroy(nodelist_split_t *split);
+
+/*
+ * Random access to a list's hosts:  the position of each range's first
+ * host is tabulated once, and a position is then found by bisection.
+ */
+typedef struct {
+    const nodelist_t    *nl;
+    size_t              *first;
+} nodelist_locator_t;
+
+void nodelist_locator_init(nodelist_locator_t *loc, const nodelist_t *nl);
+void nodelist_locator_destroy(nodelist_locator_t *loc);
+
+/*
+ * Write the name of host <position> to <buf> (which must hold at least
+ * nodelist_host_len_max() + 1 characters); returns the length.
+ */
+size_t nodelist_locator_render(const nodelist_locator_t *loc, size_t position, char *buf);
+
+/*
+ * Append hosts [start,end) of the located list to <nl>.
+ */
+void nodelist_locator_append(const nodelist_locator_t *loc, nodelist_t *nl, size_t start,
+            size_t end);
+
+/*
+ * Position (counted from zero, in list order) of the first occurrence of
+ * <host>; returns false if the host is not in the list.  The name is
+ * parsed once and each range is then tested with integer comparisons.
+ */
+bool nodelist_position(const nodelist_t *nl, const char *host, size_t host_len,
+            size_t *position);
+
+/*
+ * Compressed (ranged) form of the list.  The length is computed from
+ * the range table so the string is rendered exactly once into a buffer
+ * of the right size; the caller frees the returned string.
+ */
+size_t nodelist_ranged_string_len(const nodelist_t *nl);
+char* nodelist_ranged_string(const nodelist_t *nl);
+
+/*
+ * Expanded form of the list, names separated by <delimiter>.  Each range
+ * keeps one rendered name whose digits are stepped in place like an
+ * odometer, and names are copied straight into the output blocks.
+ * Returns false if writing the output failed.
+ */
+bool nodelist_expand(const nodelist_t *nl, const char *delimiter, size_t delimiter_len,
+            output_t *out);
+
+/*
+ * The same output, rendered by up to <threads> worker threads:  the list
+ * is cut into slices of hosts which the workers render into private
+ * buffers, and the buffers are written to <out> in order.  Small lists
+ * are expanded on the calling thread.
+ */
+bool nodelist_expand_threaded(const nodelist_t *nl, const char *delimiter, size_t delimiter_len,
+            output_t *out, unsigned threads);
+
+/*
+ * Longest possible host name in the list (excluding the NUL).
+ */
+size_t nodelist_host_len_max(const nodelist_t *nl);
+
+/*
+ * Write the name of host <num> of range <r> to <buf> (which must hold
+ * at least nodelist_host_len_max() + 1 characters); returns the length.
+ */
+size_t nodelist_render_host(const nodelist_t *nl, const nodelist_range_t *r,
+            unsigned long num, char *buf);
+
+//
+
+typedef struct {
+    const nodelist_t    *nl;
+    size_t              range_idx;
+    unsigned long       num;
+    size_t              position;
+    char                *buffer;
+
+    /* The parts of the host last returned: */
+    const char          *prefix;
+    size_t              prefix_len;
+    unsigned long       host_num;
+    int                 host_digits;    /* 0 => no numeric suffix */
+    int                 host_padded_width;  /* 0 => the number is not zero-padded */
+} nodelist_iter_t;
+
+void nodelist_iter_init(nodelist_iter_t *it, const nodelist_t *nl);
+const char* nodelist_iter_next(nodelist_iter_t *it, size_t *host_len);
+
+/*
+ * Position the iterator so that the next host returned is host <position>
+ * of the list (counted from zero).  Seeking forward steps over whole
+ * ranges from the current position; seeking back starts over.
+ */
+void nodelist_iter_seek(nodelist_iter_t *it, size_t position);
+void nodelist_iter_destroy(nodelist_iter_t *it);
+
+#endif /* __NODELIST_H__ */
@@ -0,0 +1,405 @@
+/*
+ * output.c
+ *
+ * Buffered output for snodelist.  See output.h for an overview.
+ *
+ */
+
+#ifndef _GNU_SOURCE
+#   define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "output.h"
+
+//
+
+static char*
+__output_block_alloc(void)
+{
+    void            *block = mmap(NULL, OUTPUT_BLOCK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if ( block == MAP_FAILED ) {
+        fprintf(stderr, "FATAL:  unable to allocate memory for output\n");
+        exit(ENOMEM);
+    }
+    return (char*)block;
+}
+
+//
+
+static output_t*
+__output_alloc(void)
+{
+    output_t        *out = calloc(1, sizeof(output_t));
+
+    if ( out ) {
+        out->block_count = OUTPUT_BLOCK_COUNT;
+        out->block = calloc(out->block_count, sizeof(char*));
+    }
+    if ( ! out || ! out->block ) {
+        fprintf(stderr, "FATAL:  unable to allocate memory for output\n");
+        exit(ENOMEM);
+    }
+    out->ok = true;
+    out->current = 0;
+    out->block[0] = __output_block_alloc();
+    out->ptr = out->block[0];
+    out->end = out->ptr + OUTPUT_BLOCK_SIZE;
+    return out;
+}
+
+//
+
+output_t*
+output_create(
+    int             fd
+)
+{
+    output_t        *out = __output_alloc();
+    struct stat     finfo;
+
+    out->fd = fd;
+    out->use_vmsplice = ( (fstat(fd, &finfo) == 0) && S_ISFIFO(finfo.st_mode) );
+    return out;
+}
+
+//
+
+output_t*
+output_create_buffer(void)
+{
+    output_t        *out = __output_alloc();
+
+    out->fd = -1;
+    return out;
+}
+
+//
+
+static bool
+__output_fail(
+    output_t        *out,
+    int             error
+)
+{
+    out->ok = false;
+    out->error = error;
+    return false;
+}
+
+/*
+ * Push the iovecs to the descriptor, coping with partial writes.
+ */
+static bool
+__output_writev(
+    output_t        *out,
+    struct iovec    *iov,
+    int             iov_count
+)
+{
+    while ( iov_count > 0 ) {
+        ssize_t     n = writev(out->fd, iov, iov_count);
+
+        if ( n < 0 ) {
+            if ( errno == EINTR ) continue;
+            return __output_fail(out, errno);
+        }
+        while ( (iov_count > 0) && ((size_t)n >= iov->iov_len) ) {
+            n -= iov->iov_len;
+            iov++, iov_count--;
+        }
+        if ( iov_count > 0 ) {
+            iov->iov_base = (char*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return true;
+}
+
+/*
+ * Gift the pages to the pipe.  Returns the number of iovecs fully
+ * spliced; if vmsplice() is not usable here the remainder is left for
+ * writev().
+ */
+static int
+__output_vmsplice(
+    output_t        *out,
+    struct iovec    *iov,
+    int             iov_count
+)
+{
+    int             done = 0;
+
+    while ( done < iov_count ) {
+        ssize_t     n = vmsplice(out->fd, iov + done, iov_count - done, SPLICE_F_GIFT);
+
+        if ( n < 0 ) {
+            if ( errno == EINTR ) continue;
+            if ( errno != EPIPE ) out->use_vmsplice = false;
+            else __output_fail(out, errno);
+            break;
+        }
+        while ( (done < iov_count) && ((size_t)n >= iov[done].iov_len) ) {
+            n -= iov[done].iov_len;
+            done++;
+        }
+        if ( done < iov_count ) {
+            iov[done].iov_base = (char*)iov[done].iov_base + n;
+            iov[done].iov_len -= n;
+        }
+    }
+    return done;
+}
+
+/*
+ * Write all queued blocks (and the filled part of the current one)
+ * followed by the optional <extra> buffer, then start over with an empty
+ * current block.
+ */
+static bool
+__output_drain(
+    output_t        *out,
+    const char      *extra,
+    size_t          extra_len
+)
+{
+    struct iovec    iov[OUTPUT_BLOCK_COUNT + 1];
+    unsigned        iov_block[OUTPUT_BLOCK_COUNT];
+    size_t          iov_len[OUTPUT_BLOCK_COUNT];
+    int             iov_count = 0, block_iov_count, spliced = 0, touched = 0, k;
+    unsigned        i;
+
+    for ( i = 0; i <= out->current; i++ ) {
+        size_t      len = (i == out->current) ? (size_t)(out->ptr - out->block[i]) : OUTPUT_BLOCK_SIZE;
+
+        if ( len ) {
+            iov[iov_count].iov_base = out->block[i];
+            iov[iov_count].iov_len = iov_len[iov_count] = len;
+            iov_block[iov_count] = i;
+            iov_count++;
+        }
+    }
+    block_iov_count = iov_count;
+    if ( out->ok && out->use_vmsplice && block_iov_count ) {
+        spliced = touched = __output_vmsplice(out, iov, block_iov_count);
+        if ( (spliced < block_iov_count) && (iov[spliced].iov_len != iov_len[spliced]) ) touched++;
+    }
+    if ( extra_len ) {
+        iov[iov_count].iov_base = (void*)extra;
+        iov[iov_count].iov_len = extra_len;
+        iov_count++;
+    }
+    if ( out->ok && (spliced < iov_count) ) __output_writev(out, iov + spliced, iov_count - spliced);
+
+    /* Pages handed to the pipe belong to it now, so any block vmsplice()
+     * touched is replaced rather than reused:
+     */
+    for ( k = 0; k < touched; k++ ) {
+        munmap(out->block[iov_block[k]], OUTPUT_BLOCK_SIZE);
+        out->block[iov_block[k]] = NULL;
+    }
+    if ( ! out->block[0] ) out->block[0] = __output_block_alloc();
+    out->current = 0;
+    out->ptr = out->block[0];
+    out->end = out->ptr + OUTPUT_BLOCK_SIZE;
+    return out->ok;
+}
+
+//
+
+bool
+__output_write_slow(
+    output_t        *out,
+    const char      *buf,
+    size_t          len
+)
+{
+    if ( ! out->ok ) return false;
+
+    /* Big buffers go straight out behind whatever is already queued: */
+    if ( (len >= OUTPUT_BLOCK_SIZE) && (out->fd >= 0) ) return __output_drain(out, buf, len);
+
+    while ( len ) {
+        size_t      space = out->end - out->ptr;
+
+        if ( space == 0 ) {
+            if ( (++out->current == out->block_count) && (out->fd < 0) ) {
+                /* In memory the list of blocks just grows: */
+                char    **new_block = realloc(out->block, 2 * out->block_count * sizeof(char*));
+
+                if ( ! new_block ) {
+                    fprintf(stderr, "FATAL:  unable to allocate memory for output\n");
+                    exit(ENOMEM);
+                }
+                memset(new_block + out->block_count, 0, out->block_count * sizeof(char*));
+                out->block = new_block;
+                out->block_count *= 2;
+            }
+            if ( out->current == out->block_count ) {
+                out->current--;
+                if ( ! __output_drain(out, NULL, 0) ) return false;
+            } else {
+                if ( ! out->block[out->current] ) out->block[out->current] = __output_block_alloc();
+                out->ptr = out->block[out->current];
+                out->end = out->ptr + OUTPUT_BLOCK_SIZE;
+            }
+            continue;
+        }
+        if ( space > len ) space = len;
+        memcpy(out->ptr, buf, space);
+        out->ptr += space;
+        buf += space;
+        len -= space;
+    }
+    return true;
+}
+
+//
+
+bool
+output_int(
+    output_t        *out,
+    long            value
+)
+{
+    char            digits[24];
+    int             d = sizeof(digits);
+    unsigned long   v = (value < 0) ? -(unsigned long)value : (unsigned long)value;
+
+    do {
+        digits[--d] = '0' + (v % 10);
+        v /= 10;
+    } while ( v );
+    if ( value < 0 ) digits[--d] = '-';
+    return output_write(out, digits + d, sizeof(digits) - d);
+}
+
+//
+
+bool
+output_repeat(
+    output_t        *out,
+    const char      *buf,
+    size_t          len,
+    size_t          count
+)
+{
+    if ( len == 0 ) return out->ok;
+    while ( count && out->ok ) {
+        size_t      fit = (out->end - out->ptr) / len, done = 1;
+
+        if ( fit == 0 ) {
+            /* This copy straddles a block boundary: */
+            output_write(out, buf, len);
+            count--;
+            continue;
+        }
+        if ( fit > count ) fit = count;
+        memcpy(out->ptr, buf, len);
+        while ( done < fit ) {
+            size_t  n = (done < fit - done) ? done : (fit - done);
+
+            memcpy(out->ptr + done * len, out->ptr, n * len);
+            done += n;
+        }
+        out->ptr += fit * len;
+        count -= fit;
+    }
+    return out->ok;
+}
+
+//
+
+size_t
+output_length(
+    const output_t  *out
+)
+{
+    return (size_t)out->current * OUTPUT_BLOCK_SIZE + (out->ptr - out->block[out->current]);
+}
+
+//
+
+bool
+output_append(
+    output_t        *out,
+    const output_t  *buffer
+)
+{
+    unsigned        i;
+
+    for ( i = 0; i <= buffer->current; i++ ) {
+        size_t      len = (i == buffer->current) ? (size_t)(buffer->ptr - buffer->block[i]) : OUTPUT_BLOCK_SIZE;
+
+        if ( len ) output_write(out, buffer->block[i], len);
+    }
+    return out->ok;
+}
+
+//
+
+void
+output_copy(
+    const output_t  *buffer,
+    char            *dst
+)
+{
+    unsigned        i;
+
+    for ( i = 0; i <= buffer->current; i++ ) {
+        size_t      len = (i == buffer->current) ? (size_t)(buffer->ptr - buffer->block[i]) : OUTPUT_BLOCK_SIZE;
+
+        memcpy(dst, buffer->block[i], len);
+        dst += len;
+    }
+}
+
+//
+
+void
+output_clear(
+    output_t        *buffer
+)
+{
+    buffer->current = 0;
+    buffer->ptr = buffer->block[0];
+    buffer->end = buffer->ptr + OUTPUT_BLOCK_SIZE;
+}
+
+//
+
+bool
+output_flush(
+    output_t        *out
+)
+{
+    if ( out->fd < 0 ) return out->ok;
+    if ( out->ok && ((out->current > 0) || (out->ptr > out->block[0])) ) __output_drain(out, NULL, 0);
+    return out->ok;
+}
+
+//
+
+bool
+output_destroy(
+    output_t        *out
+)
+{
+    bool            rc = output_flush(out);
+    unsigned        i;
+
+    for ( i = 0; i < out->block_count; i++ ) {
+        if ( out->block[i] ) munmap(out->block[i], OUTPUT_BLOCK_SIZE);
+    }
+    free(out->block);
+    free(out);
+    return rc;
+}
@@ -0,0 +1,116 @@
+/*
+ * output.h
+ *
+ * Buffered output for snodelist.
+ *
+ * Everything written to stdout goes through an output_t:  text is packed
+ * into large page-aligned blocks, and full blocks are queued until
+ * several can be handed to the kernel at once -- with writev(), or with
+ * vmsplice() when the descriptor is a pipe (the blocks are then gifted
+ * to the pipe and replaced rather than reused).
+ *
+ * An output_t can also collect text in memory (output_create_buffer())
+ * so that it can be measured before it is copied to another output_t.
+ *
+ */
+
+#ifndef __OUTPUT_H__
+#define __OUTPUT_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#define OUTPUT_BLOCK_SIZE       (256 * 1024)
+#define OUTPUT_BLOCK_COUNT      8
+
+typedef struct {
+    int             fd;             /* -1 => text is kept in memory */
+    bool            use_vmsplice;
+    bool            ok;
+    int             error;
+    char            **block;
+    unsigned        block_count;
+    unsigned        current;        /* blocks before this one are full */
+    char            *ptr, *end;     /* free space in the current block */
+} output_t;
+
+output_t* output_create(int fd);
+
+/*
+ * An in-memory output_t:  its blocks are never written anywhere, the
+ * block list just grows as needed.
+ */
+output_t* output_create_buffer(void);
+
+/*
+ * Flushes any buffered output; returns false if any write failed, with
+ * the errno value in out->error.
+ */
+bool output_destroy(output_t *out);
+bool output_flush(output_t *out);
+
+bool __output_write_slow(output_t *out, const char *buf, size_t len);
+
+static inline bool
+output_write(
+    output_t        *out,
+    const char      *buf,
+    size_t          len
+)
+{
+    if ( len <= (size_t)(out->end - out->ptr) ) {
+        memcpy(out->ptr, buf, len);
+        out->ptr += len;
+        return true;
+    }
+    return __output_write_slow(out, buf, len);
+}
+
+static inline bool
+output_putc(
+    output_t        *out,
+    char            c
+)
+{
+    if ( out->ptr == out->end ) return __output_write_slow(out, &c, 1);
+    *out->ptr++ = c;
+    return true;
+}
+
+static inline bool
+output_puts(
+    output_t        *out,
+    const char      *s
+)
+{
+    return output_write(out, s, strlen(s));
+}
+
+bool output_int(output_t *out, long value);
+
+/*
+ * Write <count> copies of <buf>:  one copy is placed in the current
+ * block and then doubled in place until the block (or count) is used up.
+ */
+bool output_repeat(output_t *out, const char *buf, size_t len, size_t count);
+
+/*
+ * Number of bytes presently held in <out>'s blocks.
+ */
+size_t output_length(const output_t *out);
+
+/*
+ * Write everything held in the in-memory <buffer> to <out>.
+ */
+bool output_append(output_t *out, const output_t *buffer);
+
+/*
+ * Copy the text held in the in-memory <buffer> to <dst>, which must have
+ * room for output_length() bytes; output_clear() empties <buffer> (its
+ * blocks are kept for reuse).
+ */
+void output_copy(const output_t *buffer, char *dst);
+void output_clear(output_t *buffer);
+
+#endif /* __OUTPUT_H__ */
@@ -0,0 +1,191 @@
+/*
+ * result_cache.c
+ *
+ * Least-recently-used cache of rendered query results.  See
+ * result_cache.h for an overview.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "result_cache.h"
+
+//
+
+static void*
+__result_cache_alloc(
+    size_t      size
+)
+{
+    void        *ptr = malloc(size);
+
+    if ( ! ptr ) {
+        fprintf(stderr, "FATAL:  unable to allocate memory for result cache\n");
+        exit(ENOMEM);
+    }
+    return ptr;
+}
+
+//
+
+result_cache_t*
+result_cache_create(
+    size_t          entry_max,
+    size_t          byte_max
+)
+{
+    result_cache_t  *cache = __result_cache_alloc(sizeof(result_cache_t));
+
+    /* Entries are bounded, so the bucket array is sized once: */
+    cache->bucket_count = 16;
+    while ( cache->bucket_count < entry_max ) cache->bucket_count *= 2;
+    cache->bucket = calloc(cache->bucket_count, sizeof(result_cache_entry_t*));
+    if ( ! cache->bucket ) {
+        fprintf(stderr, "FATAL:  unable to allocate memory for result cache\n");
+        exit(ENOMEM);
+    }
+    cache->lru_head = cache->lru_tail = NULL;
+    cache->entry_count = 0;
+    cache->entry_max = entry_max;
+    cache->byte_count = 0;
+    cache->byte_max = byte_max;
+    return cache;
+}
+
+//
+
+static void
+__result_cache_unlink(
+    result_cache_t          *cache,
+    result_cache_entry_t    *entry
+)
+{
+    if ( entry->lru_prev ) entry->lru_prev->lru_next = entry->lru_next;
+    else cache->lru_head = entry->lru_next;
+    if ( entry->lru_next ) entry->lru_next->lru_prev = entry->lru_prev;
+    else cache->lru_tail = entry->lru_prev;
+}
+
+static void
+__result_cache_link_head(
+    result_cache_t          *cache,
+    result_cache_entry_t    *entry
+)
+{
+    entry->lru_prev = NULL;
+    entry->lru_next = cache->lru_head;
+    if ( cache->lru_head ) cache->lru_head->lru_prev = entry;
+    else cache->lru_tail = entry;
+    cache->lru_head = entry;
+}
+
+static void
+__result_cache_remove(
+    result_cache_t          *cache,
+    result_cache_entry_t    *entry
+)
+{
+    result_cache_entry_t    **link = &cache->bucket[entry->hash & (cache->bucket_count - 1)];
+
+    while ( *link != entry ) link = &(*link)->hash_next;
+    *link = entry->hash_next;
+    __result_cache_unlink(cache, entry);
+    cache->entry_count--;
+    cache->byte_count -= entry->key_len + entry->value_len;
+    free(entry->key);
+    free(entry->value);
+    free(entry);
+}
+
+//
+
+void
+result_cache_destroy(
+    result_cache_t  *cache
+)
+{
+    if ( cache ) {
+        while ( cache->lru_head ) __result_cache_remove(cache, cache->lru_head);
+        free(cache->bucket);
+        free(cache);
+    }
+}
+
+//
+
+static result_cache_entry_t*
+__result_cache_find(
+    result_cache_t          *cache,
+    uint64_t                hash,
+    const char              *key,
+    size_t                  key_len
+)
+{
+    result_cache_entry_t    *entry = cache->bucket[hash & (cache->bucket_count - 1)];
+
+    while ( entry ) {
+        if ( (entry->hash == hash) && (entry->key_len == key_len) && (memcmp(entry->key, key, key_len) == 0) ) break;
+        entry = entry->hash_next;
+    }
+    return entry;
+}
+
+const result_cache_entry_t*
+result_cache_lookup(
+    result_cache_t          *cache,
+    const char              *key,
+    size_t                  key_len
+)
+{
+    result_cache_entry_t    *entry = __result_cache_find(cache, result_cache_hash(key, key_len), key, key_len);
+
+    if ( entry && (entry != cache->lru_head) ) {
+        __result_cache_unlink(cache, entry);
+        __result_cache_link_head(cache, entry);
+    }
+    return entry;
+}
+
+//
+
+char*
+result_cache_insert(
+    result_cache_t          *cache,
+    const char              *key,
+    size_t                  key_len,
+    int                     status,
+    size_t                  value_len
+)
+{
+    uint64_t                hash = result_cache_hash(key, key_len);
+    result_cache_entry_t    *entry = __result_cache_find(cache, hash, key, key_len);
+    result_cache_entry_t    **bucket;
+
+    if ( entry ) __result_cache_remove(cache, entry);
+    if ( (cache->entry_max == 0) || (key_len + value_len > cache->byte_max) ) return NULL;
+
+    /* Make room by dropping the least recently used entries: */
+    while ( cache->lru_tail && ((cache->entry_count == cache->entry_max) ||
+                (cache->byte_count + key_len + value_len > cache->byte_max)) ) {
+        __result_cache_remove(cache, cache->lru_tail);
+    }
+
+    entry = __result_cache_alloc(sizeof(result_cache_entry_t));
+    entry->hash = hash;
+    entry->key = __result_cache_alloc(key_len ? key_len : 1);
+    memcpy(entry->key, key, key_len);
+    entry->key_len = key_len;
+    entry->status = status;
+    entry->value = __result_cache_alloc(value_len ? value_len : 1);
+    entry->value_len = value_len;
+
+    bucket = &cache->bucket[hash & (cache->bucket_count - 1)];
+    entry->hash_next = *bucket;
+    *bucket = entry;
+    __result_cache_link_head(cache, entry);
+    cache->entry_count++;
+    cache->byte_count += key_len + value_len;
+    return entry->value;
+}
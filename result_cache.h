@@ -0,0 +1,79 @@
+/*
+ * result_cache.h
+ *
+ * Least-recently-used cache of rendered query results for the snodelist
+ * server.  Entries map a key (the canonical words of a query) to the
+ * exit status and output text of that query; the cache is bounded both
+ * in entries and in the total size of keys and values, and the least
+ * recently used entries are dropped to stay within the bounds.
+ *
+ * A result_cache_t is not locked internally.
+ *
+ */
+
+#ifndef __RESULT_CACHE_H__
+#define __RESULT_CACHE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define RESULT_CACHE_MAX_ENTRIES    4096
+#define RESULT_CACHE_MAX_BYTES      (64 * 1024 * 1024)
+
+typedef struct result_cache_entry {
+    struct result_cache_entry   *hash_next;
+    struct result_cache_entry   *lru_prev, *lru_next;
+    uint64_t                    hash;
+    char                        *key;
+    size_t                      key_len;
+    int                         status;
+    char                        *value;
+    size_t                      value_len;
+} result_cache_entry_t;
+
+typedef struct {
+    result_cache_entry_t        **bucket;
+    size_t                      bucket_count;
+    result_cache_entry_t        *lru_head, *lru_tail;  /* most recently used first */
+    size_t                      entry_count, entry_max;
+    size_t                      byte_count, byte_max;
+} result_cache_t;
+
+/*
+ * 64-bit FNV-1a hash of <len> bytes; the cache keys its entries with it,
+ * and it serves snodelist's other tables and file names as well.
+ */
+static inline uint64_t
+result_cache_hash(
+    const char  *s,
+    size_t      len
+)
+{
+    uint64_t    h = 14695981039346656037ULL;
+
+    while ( len-- ) {
+        h ^= (unsigned char)*s++;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+result_cache_t* result_cache_create(size_t entry_max, size_t byte_max);
+void result_cache_destroy(result_cache_t *cache);
+
+/*
+ * Returns the entry for the key (and marks it most recently used), or
+ * NULL.  The entry is only valid until the next result_cache_insert().
+ */
+const result_cache_entry_t* result_cache_lookup(result_cache_t *cache, const char *key, size_t key_len);
+
+/*
+ * Add (or replace) the entry for the key, which is copied; returns the
+ * entry's <value_len>-byte value buffer for the caller to fill in.  Values
+ * too large for the cache as a whole are not added (NULL is returned).
+ */
+char* result_cache_insert(result_cache_t *cache, const char *key, size_t key_len,
+            int status, size_t value_len);
+
+#endif /* __RESULT_CACHE_H__ */
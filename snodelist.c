@@ -17,19 +17,36 @@
  * or compressed form -- with options for removal of duplicate
  * names, alternate delimiter in expanded form, etc.
  *
- * This program links to the Slurm library to directly use the
- * hostlist API (rather than implementing the parsing itself).
+ * Host lists are handled by a native range-based engine (see
+ * nodelist.h) whose cost scales with the number of ranges rather
+ * than the number of hosts.  The program still links to the Slurm
+ * library:  its hostlist API can be selected at runtime as the
+ * reference backend (--backend=slurm or SNODELIST_BACKEND=slurm).
  *
  */
 
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <ctype.h>
 #include <errno.h>
+#include <limits.h>
 #include <getopt.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include "slurm/slurm.h"
+#include "nodelist.h"
+#include "output.h"
+#include "result_cache.h"
 
 #if SLURM_VERSION_NUMBER >= SLURM_VERSION_NUM(23,11,0)
 #   define HOSTLIST_T               hostlist_t*
@@ -42,15 +59,22 @@
         static size_t   __buffer_len = 0;
 
         while ( 1 ) {
-            ssize_t     cstr_len = slurm_hostlist_ranged_string(a_hostlist, __buffer_len, __buffer);
+            ssize_t     cstr_len = (__buffer_len > 0) ? slurm_hostlist_ranged_string(a_hostlist, __buffer_len, __buffer) : -1;
 
             if ( cstr_len < 0 ) {
                 /* Need to extend the buffer...sadly, we didn't get any feedback re: what length would be
-                 * sufficient...
+                 * sufficient.  Each failed attempt re-renders (at most) the whole buffer, so grow it
+                 * geometrically:  the failed attempts then cost no more than the final one and the
+                 * whole conversion stays linear in the length of the string.
                  */
-                size_t  new_buffer_len = __buffer_len + 4096;
-                char    *new_buffer = realloc(__buffer, new_buffer_len);
+                size_t  new_buffer_len = (__buffer_len > 0) ? 2 * __buffer_len : 4096;
+                char    *new_buffer;
 
+                if ( new_buffer_len < __buffer_len ) {
+                    fprintf(stderr, "FATAL:  node list string is too long\n");
+                    exit(ENOMEM);
+                }
+                new_buffer = realloc(__buffer, new_buffer_len);
                 if ( ! new_buffer ) {
                     fprintf(stderr, "FATAL:  unable to allocate memory for node list string\n");
                     exit(ENOMEM);
@@ -75,23 +99,138 @@ typedef enum {
     snodelist_mode_expand       = 0,
     snodelist_mode_compress     = 1,
     snodelist_mode_machinefile  = 2,
+    snodelist_mode_count        = 3,
+    snodelist_mode_index        = 4,
+    snodelist_mode_rank         = 5,
+    snodelist_mode_distribution = 6,
+    snodelist_mode_tasks        = 7,
+    snodelist_mode_hostfile     = 8,
+    snodelist_mode_tree         = 9,
     //
     snodelist_mode_default = snodelist_mode_expand
 } snodelist_mode;
 
+/*
+ * Tree width when only --tree-host is given; Slurm's default TreeWidth.
+ */
+#define SNODELIST_TREE_WIDTH_DEFAULT    50
+
 static const char*  snodelist_mode_strings[] = {
                                                 "expand",
                                                 "compress",
                                                 "machinefile",
+                                                "count",
+                                                "index-of",
+                                                "rank",
+                                                "distribution",
+                                                "tasks",
+                                                "from-hostfile",
+                                                "tree",
+                                                NULL
+                                            };
+
+//
+
+typedef enum {
+    snodelist_backend_native    = 0,
+    snodelist_backend_slurm     = 1,
+    //
+    snodelist_backend_default = snodelist_backend_native
+} snodelist_backend;
+
+static const char*  snodelist_backend_strings[] = {
+                                                "native",
+                                                "slurm",
+                                                NULL
+                                            };
+
+bool
+snodelist_backend_from_string(
+    const char          *s,
+    snodelist_backend   *backend
+)
+{
+    int                 i = 0;
+
+    while ( snodelist_backend_strings[i] ) {
+        if ( strcmp(s, snodelist_backend_strings[i]) == 0 ) {
+            *backend = (snodelist_backend)i;
+            return true;
+        }
+        i++;
+    }
+    fprintf(stderr, "ERROR:  unknown host list backend: %s\n", s);
+    return false;
+}
+
+//
+
+/*
+ * Names of the set operators, indexed by nodelist_set_op:
+ */
+static const char*  snodelist_set_op_strings[] = {
+                                                NULL,
+                                                "union",
+                                                "intersect",
+                                                "minus",
+                                                "xor"
+                                            };
+
+/*
+ * Names of the sort orders, indexed by nodelist_sort_order:
+ */
+static const char*  snodelist_sort_order_strings[] = {
+                                                "input",
+                                                "natural",
+                                                "numeric",
+                                                "reverse",
                                                 NULL
                                             };
 
 //
 
 static const char   *snodelist_default_delimiter = "\n";
+static const char   *snodelist_default_machinefile_format = "%h%[:]C";
+static const char   *snodelist_default_job_cache_dir = "/dev/shm";
 
 //
 
+/*
+ * Options that only have a long form:
+ */
+enum {
+    snodelist_opt_batch         = 0x100,
+    snodelist_opt_serve,
+    snodelist_opt_job_cache,
+    snodelist_opt_job_cache_clean,
+    snodelist_opt_union,
+    snodelist_opt_intersect,
+    snodelist_opt_minus,
+    snodelist_opt_xor,
+    snodelist_opt_count,
+    snodelist_opt_head,
+    snodelist_opt_tail,
+    snodelist_opt_slice,
+    snodelist_opt_nth,
+    snodelist_opt_index_of,
+    snodelist_opt_whoami,
+    snodelist_opt_first_rank,
+    snodelist_opt_rank_host,
+    snodelist_opt_host_ranks,
+    snodelist_opt_local_rank,
+    snodelist_opt_distribution,
+    snodelist_opt_rankfile,
+    snodelist_opt_tasks,
+    snodelist_opt_from_hostfile,
+    snodelist_opt_split,
+    snodelist_opt_split_size,
+    snodelist_opt_split_tasks,
+    snodelist_opt_tree,
+    snodelist_opt_tree_host,
+    snodelist_opt_unique,
+    snodelist_opt_sort
+};
+
 static struct option snodelist_opts[] = {
                                                 { "help",         no_argument,        NULL, 'h' },
                                                 { "expand",       no_argument,        NULL, 'e' },
@@ -100,15 +239,47 @@ static struct option snodelist_opts[] = {
                                                 { "exclude-env",  required_argument,  NULL, 'X' },
                                                 { "exclude",      required_argument,  NULL, 'x' },
                                                 { "nodelist",     required_argument,  NULL, 'l' },
-                                                { "unique",       no_argument,        NULL, 'u' },
+                                                { "unique",       optional_argument,  NULL, snodelist_opt_unique },
                                                 { "delimiter",    required_argument,  NULL, 'd' },
+                                                { "expand-format", required_argument, NULL, 'F' },
                                                 { "machinefile",  no_argument,        NULL, 'm' },
                                                 { "format",       required_argument,  NULL, 'f' },
                                                 { "no-repeats",   no_argument,        NULL, 'n' },
+                                                { "backend",      required_argument,  NULL, 'B' },
+                                                { "threads",      required_argument,  NULL, 'T' },
+                                                { "batch",        no_argument,        NULL, snodelist_opt_batch },
+                                                { "serve",        required_argument,  NULL, snodelist_opt_serve },
+                                                { "job-cache",    optional_argument,  NULL, snodelist_opt_job_cache },
+                                                { "job-cache-clean", optional_argument, NULL, snodelist_opt_job_cache_clean },
+                                                { "union",        no_argument,        NULL, snodelist_opt_union },
+                                                { "intersect",    no_argument,        NULL, snodelist_opt_intersect },
+                                                { "minus",        no_argument,        NULL, snodelist_opt_minus },
+                                                { "xor",          no_argument,        NULL, snodelist_opt_xor },
+                                                { "count",        no_argument,        NULL, snodelist_opt_count },
+                                                { "head",         required_argument,  NULL, snodelist_opt_head },
+                                                { "tail",         required_argument,  NULL, snodelist_opt_tail },
+                                                { "slice",        required_argument,  NULL, snodelist_opt_slice },
+                                                { "nth",          required_argument,  NULL, snodelist_opt_nth },
+                                                { "index-of",     optional_argument,  NULL, snodelist_opt_index_of },
+                                                { "whoami",       no_argument,        NULL, snodelist_opt_whoami },
+                                                { "first-rank",   optional_argument,  NULL, snodelist_opt_first_rank },
+                                                { "rank-host",    required_argument,  NULL, snodelist_opt_rank_host },
+                                                { "host-ranks",   required_argument,  NULL, snodelist_opt_host_ranks },
+                                                { "local-rank",   required_argument,  NULL, snodelist_opt_local_rank },
+                                                { "distribution", required_argument,  NULL, snodelist_opt_distribution },
+                                                { "rankfile",     no_argument,        NULL, snodelist_opt_rankfile },
+                                                { "tasks",        required_argument,  NULL, snodelist_opt_tasks },
+                                                { "from-hostfile", no_argument,       NULL, snodelist_opt_from_hostfile },
+                                                { "split",        required_argument,  NULL, snodelist_opt_split },
+                                                { "split-size",   required_argument,  NULL, snodelist_opt_split_size },
+                                                { "split-tasks",  optional_argument,  NULL, snodelist_opt_split_tasks },
+                                                { "tree",         required_argument,  NULL, snodelist_opt_tree },
+                                                { "tree-host",    optional_argument,  NULL, snodelist_opt_tree_host },
+                                                { "sort",         required_argument,  NULL, snodelist_opt_sort },
                                                 { NULL,           0,                  NULL,  0  }
                                             };
 
-static const char   *snodelist_opts_string = "heci:X:x:l:ud:mf:n";
+static const char   *snodelist_opts_string = "heci:X:x:l:ud:F:mf:nB:T:";
 
 //
 
@@ -125,15 +296,81 @@ usage(
             " options:\n"
             "\n"
             "  -h/--help                        show this information\n"
+            "  -B/--backend=<name>              host list implementation to use:  native (the\n"
+            "                                   default) or slurm (the libslurm hostlist API);\n"
+            "                                   the SNODELIST_BACKEND environment variable sets\n"
+            "                                   the default; commands using options that only the\n"
+            "                                   native backend implements run there regardless,\n"
+            "                                   with a warning\n"
+            "  -T/--threads=<N>                 number of threads the native backend may use to read\n"
+            "                                   host lists (default:  the number of online CPUs)\n"
+            "  --job-cache{=<dir>}              keep the output in a file in <dir> (default:  /dev/shm)\n"
+            "                                   named for SLURM_JOB_ID and the command, so that\n"
+            "                                   later runs of the same command in the job just copy\n"
+            "                                   it out; the files of a job share one directory\n"
+            "  --job-cache-clean{=<dir>}        remove the job cache directories of SLURM_JOB_ID from\n"
+            "                                   <dir> (default:  /dev/shm), e.g. in a job epilog\n"
             "\n"
             "  EXPAND / COMPRESS MODES\n"
             "\n"
             "    -e/--expand                    output as individual names (default mode)\n"
             "      -d/--delimiter <str>         use <str> between each hostname in expanded mode\n"
             "                                   (default:  a newline character)\n"
+            "      -F/--expand-format <fmt>     output each hostname according to <fmt>:\n"
+            "                                     %%h = the hostname\n"
+            "                                     %%i = its position in the list (from 0)\n"
+            "                                     %%p = its prefix\n"
+            "                                     %%n = its numeric suffix, as written in the name\n"
+            "                                     %%w = the width the suffix is zero-padded to\n"
+            "                                           (0 if it is not padded)\n"
+            "                                     %%{<v><op><int>...} = arithmetic on v = n, i or w\n"
+            "                                           (ops +, -, *, / and %%, left to right)\n"
+            "                                     %%%% = a literal percent sign\n"
+            "                                   names without a numeric suffix leave %%n and\n"
+            "                                   %%{n...} empty\n"
             "\n"
             "    -c/--compress                  output in compressed (compact) form\n"
             "\n"
+            "    --count                        output the number of hosts\n"
+            "\n"
+            "    --head=<N>                     select the first <N> hosts of the final node list\n"
+            "    --tail=<N>                     select the last <N> hosts of the final node list\n"
+            "    --slice=<A>:<B>                select hosts <A> up to (but not including) <B>,\n"
+            "                                   counting from 0; negative positions count back from\n"
+            "                                   the end, and either may be omitted; an empty\n"
+            "                                   selection outputs nothing\n"
+            "    --nth=<I>                      select host <I> (counting from 0; -1 is the last);\n"
+            "                                   it is an error if there is no such host\n"
+            "\n"
+            "    --split=<N>                    output the hosts in <N> consecutive groups of (nearly)\n"
+            "                                   equal size, one group per line (fewer groups if\n"
+            "                                   there are fewer than <N> hosts)\n"
+            "    --split-size=<K>               output the hosts in consecutive groups of <K>, one\n"
+            "                                   group per line\n"
+            "      --split-tasks{=<counts>}     measure the groups in tasks rather than hosts, from\n"
+            "                                   the given task counts (default:  the\n"
+            "                                   SLURM_TASKS_PER_NODE environment variable); a host\n"
+            "                                   with more than <K> tasks is a group of its own\n"
+            "\n"
+            "    NOTE:  In expand mode the hosts of a group are separated by the -d/--delimiter\n"
+            "           string, or by commas if it holds a newline.\n"
+            "\n"
+            "    --index-of{=<host>}            output the position of <host> in the node list\n"
+            "                                   (counting from 0); without a <host>, or with\n"
+            "                                   --whoami, the name of this host is used\n"
+            "      --first-rank{=<counts>}      also output the global rank of the host's first\n"
+            "                                   task, from the given task counts (default:  the\n"
+            "                                   SLURM_TASKS_PER_NODE environment variable)\n"
+            "\n"
+            "    --tree=<W>                     output a fan-out tree over the node list like that of\n"
+            "                                   Slurm's TreeWidth forwarding:  the first host is the\n"
+            "                                   root, and each host sends to the first host of each\n"
+            "                                   of <W> equal parts of the rest of its span; one line\n"
+            "                                   per host holds the host, its parent and its children\n"
+            "                                   (\"-\" for none)\n"
+            "      --tree-host{=<host>}         only output the line of <host> (default:  this host);\n"
+            "                                   implies a <W> of %d if --tree is not given\n"
+            "\n"
             "    -i/--include-env{=<varname>}   include a host list present in the environment\n"
             "                                   variable <varname>; omitting the <varname> defaults\n"
             "                                   to using SLURM_JOB_NODELIST (can be used multiple times)\n"
@@ -142,8 +379,22 @@ usage(
             "    -X/--exclude-env=<varname>     remove all hosts present in the environment variable\n"
             "                                   <varname> from the final node list\n"
             "    -x--exclude=<host expression>  remove hosts from the final node list\n"
-            "    -u/--unique                    remove any duplicate names (for expand and compress\n"
-            "                                   modes)\n"
+            "    -u/--unique{=sorted|stable}    remove any duplicate names (for expand and compress\n"
+            "                                   modes); the list is sorted first (the default), or\n"
+            "                                   with \"stable\" each name is kept where it first\n"
+            "                                   appears\n"
+            "    --sort=<order>                 sort the names (duplicates are kept) before any host\n"
+            "                                   selection:  \"natural\" sorts by prefix and then\n"
+            "                                   number, \"numeric\" by number and then prefix,\n"
+            "                                   \"reverse\" is the natural order backwards, and\n"
+            "                                   \"input\" (the default) leaves the names in order\n"
+            "\n"
+            "    --union                        treat each host expression, -i variable and -l file\n"
+            "    --intersect                    as a separate set and combine them from left to right:\n"
+            "    --minus                        hosts in any, in all, in the first but none of the\n"
+            "    --xor                          others, or in an odd number of them; the result is\n"
+            "                                   sorted and free of duplicates, and the exclusions are\n"
+            "                                   applied to it (always computed by the native backend)\n"
             "\n"
             "    NOTE:  In the expand/compress modes, if no host lists are explicitly added then\n"
             "           SLURM_JOB_NODELIST is checked by default.\n"
@@ -169,8 +420,74 @@ usage(
             "      -n/--no-repeats              if the <line-format> lacks a count token, do not\n"
             "                                   repeat the line once for each task on the host\n"
             "\n"
+            "    --from-hostfile                read an MPI-style host file (from the -l/--nodelist\n"
+            "                                   files, or stdin) whose lines follow the -f/--format\n"
+            "                                   <line-format>, and output the hosts in compressed\n"
+            "                                   form and their task counts in SLURM_TASKS_PER_NODE\n"
+            "                                   form, one per line; a line lacking a count is one\n"
+            "                                   task, and the tasks of a host are added up; without\n"
+            "                                   -f/--format, lines of the form '<host> slots=<N>'\n"
+            "                                   are read as well\n"
+            "\n"
+            "  RANK MODE\n"
+            "\n"
+            "    --rank-host=<R>                output the host running global task rank <R>\n"
+            "    --host-ranks=<host>            output the range of global task ranks on <host>\n"
+            "    --local-rank=<R>               output the rank of task <R> among the tasks on its\n"
+            "                                   host\n"
+            "\n"
+            "    NOTE:  Ranks are placed on the hosts of SLURM_JOB_NODELIST in order, as many on\n"
+            "           each as SLURM_TASKS_PER_NODE gives.\n"
+            "\n"
+            "  DISTRIBUTION MODE\n"
+            "\n"
+            "    --distribution=<layout>        deal the ranks of the job to the hosts of\n"
+            "                                   SLURM_JOB_NODELIST, each host taking as many as\n"
+            "                                   SLURM_TASKS_PER_NODE gives it, and output each host\n"
+            "                                   with its ranks; the <layout> is one of:\n"
+            "\n"
+            "                                     block    consecutive ranks on each host\n"
+            "                                     cyclic   one rank per host in turn\n"
+            "                                     plane=N  N ranks per host in turn\n"
+            "                                     weighted each host's ranks spread evenly over\n"
+            "                                              the job, in proportion to its count\n"
+            "\n"
+            "      --rankfile                   output an MPI rankfile instead, one line per rank\n"
+            "\n"
+            "  TASKS MODE\n"
+            "\n"
+            "    --tasks=expand {<counts>}      output the task count of each host, separated by the\n"
+            "                                   -d/--delimiter string (default:  the counts in\n"
+            "                                   SLURM_TASKS_PER_NODE)\n"
+            "    --tasks=compress {<counts> ..} output the counts (given as arguments, read with -l,\n"
+            "                                   or read from stdin) in SLURM_TASKS_PER_NODE form\n"
+            "    --tasks=validate {<counts> {<host expression>}}\n"
+            "                                   check that the counts (default:  SLURM_TASKS_PER_NODE)\n"
+            "                                   cover as many hosts as the host list (default:\n"
+            "                                   SLURM_JOB_NODELIST) holds\n"
+            "\n"
+            "  BATCH MODE\n"
+            "\n"
+            "    --batch                        answer queries read from stdin, one per line:  a mode\n"
+            "                                   name (expand, compress, machinefile) followed by\n"
+            "                                   arguments as on the command line, with words quoted\n"
+            "                                   as in the shell (\\n is a newline inside \"...\");\n"
+            "                                   each answer is a line holding the exit status and\n"
+            "                                   the length of the output, then the output itself;\n"
+            "                                   options given with --batch are the defaults for\n"
+            "                                   every query\n"
+            "\n"
+            "                                     machinefile <node list> <task counts> {<line-format>}\n"
+            "\n"
+            "    --serve=<socket>               answer batch queries from clients connecting to the\n"
+            "                                   Unix domain socket <socket>, caching the answers\n"
+            "\n"
+            "    NOTE:  With SNODELIST_SOCKET=<socket> in the environment, commands are sent to the\n"
+            "           server listening on <socket> (and run locally if there is none).\n"
+            "\n"
             ,
-            exe
+            exe,
+            SNODELIST_TREE_WIDTH_DEFAULT
         );
 }
 
@@ -258,421 +575,4476 @@ task_count_next(
     return tc->value;
 }
 
+/*
+ * Consume the task counts of the next <n> hosts, adding them to <sum>;
+ * whole runs like "4(x2000)" are taken in one step.  Returns false if the
+ * counts are invalid or run out first.
+ */
+bool
+task_count_sum(
+    task_count_t    *tc,
+    size_t          n,
+    long            *sum
+)
+{
+    while ( n > 0 ) {
+        size_t      k;
+
+        if ( tc->count == 0 ) {
+            int     value = task_count_next(tc);
+
+            if ( value < 0 ) return false;
+            *sum += value;
+            n--;
+        }
+        k = ((size_t)tc->count < n) ? (size_t)tc->count : n;
+        *sum += (long)k * tc->value;
+        tc->count -= k;
+        n -= k;
+    }
+    return true;
+}
+
 //
 
+typedef enum {
+    snodelist_source_expression = 0,
+    snodelist_source_env        = 1,
+    snodelist_source_file       = 2
+} snodelist_source_type;
+
+typedef struct {
+    snodelist_source_type   type;
+    const char              *value;
+} snodelist_source_t;
+
+typedef struct {
+    snodelist_source_t      *list;
+    unsigned                count, capacity;
+} snodelist_sources_t;
+
 void
-add_from_env(
-    HOSTLIST_T    the_hostlist,
-    const char    *env_var_name
+snodelist_sources_push(
+    snodelist_sources_t     *sources,
+    snodelist_source_type   type,
+    const char              *value
 )
 {
-    char          *env_var_value = getenv(env_var_name);
+    if ( sources->count == sources->capacity ) {
+        unsigned            new_capacity = sources->capacity ? 2 * sources->capacity : 8;
+        snodelist_source_t  *new_list = realloc(sources->list, new_capacity * sizeof(snodelist_source_t));
 
-    if ( env_var_value ) slurm_hostlist_push(the_hostlist, env_var_value);
+        if ( ! new_list ) {
+            fprintf(stderr, "FATAL:  unable to allocate memory for host list sources\n");
+            exit(ENOMEM);
+        }
+        sources->list = new_list;
+        sources->capacity = new_capacity;
+    }
+    sources->list[sources->count].type = type;
+    sources->list[sources->count].value = value;
+    sources->count++;
 }
 
 //
 
+/*
+ * A selection of hosts [start,end) from the final node list.  As in
+ * Python's slices, negative positions count back from the end of the list
+ * and an omitted end means the end of the list.  An exact selection
+ * (--nth) names a single host, which must be in the list.
+ */
+typedef struct {
+    bool                    active, exact;
+    long                    start, end;
+    bool                    has_end;
+} snodelist_select_t;
+
+/*
+ * Returns false (having reported it) if an exact selection falls outside
+ * the list.
+ */
 bool
-add_from_file(
-    HOSTLIST_T    the_hostlist,
-    const char    *file
+snodelist_select_resolve(
+    const snodelist_select_t    *select,
+    size_t                      count,
+    size_t                      *start,
+    size_t                      *end
 )
 {
-    bool          rc = false;
-    FILE          *fptr = NULL;
-  
-    if ( *file == '-' && *(file+1) == '\0' ) {
-        fptr = stdin;
-    } else {
-        fptr = fopen(file, "r");
-    }
-    if ( fptr ) {
-        char      *line = NULL;
-        size_t    line_len = 0;
-    
-        rc = true;
-        while ( ! feof(fptr) ) {
-            if ( getline(&line, &line_len, fptr) > 0 ) {
-                char  *p = line;
-        
-                while ( *p ) {
-                    char  *s;
-          
-                    // Drop leading whitespace:
-                    while ( *p && isspace(*p) ) p++;
-                    // End of the line or a comment character, exit this loop:
-                    if ( ! *p || (*p == '#') ) break;
-                    s = p;
-                    // Get past the next expression:
-                    while ( *p && ! isspace(*p) ) p++;
-                    if ( p > s ) {
-                        if ( *p ) {
-                            *p = '\0';
-                            p++;
-                        }
-                        slurm_hostlist_push(the_hostlist, s);
-                    }
-                }
-            }
-        }
-        if ( line ) free(line);
-        if ( fptr != stdin ) fclose(fptr);
-    } else {
-        fprintf(stderr, "ERROR:  unable to open nodelist: %s\n", file);
+    long                        n = (long)count;
+    long                        s = select->start, e = select->has_end ? select->end : n;
+
+    if ( s < 0 ) s = (n + s > 0) ? n + s : 0;
+    else if ( s > n ) s = n;
+    if ( e < 0 ) e = (n + e > 0) ? n + e : 0;
+    else if ( e > n ) e = n;
+    *start = s;
+    *end = (e > s) ? e : s;
+    if ( select->exact && (*start == *end) ) {
+        fprintf(stderr, "ERROR:  host %ld is not in the node list (%ld hosts)\n", select->start, n);
+        return false;
     }
-    return rc;
+    return true;
 }
 
 //
 
-void
-print_machinefile(
-    HOSTLIST_T    the_hostlist,
-    HOSTLIST_T    the_hostlist_exclusions,
-    task_count_t  *tc,
-    const char    *format,
-    bool          no_repeats
+/*
+ * Index over a task count string:  one entry per value(xcount) run, with
+ * the host and global rank the run starts at, so that a rank or a host
+ * is placed by binary search over the runs.
+ */
+typedef struct {
+    long            value, count;
+    long            first_host, first_rank;
+} task_count_run_t;
+
+typedef struct {
+    task_count_run_t    *run;
+    size_t              run_count;
+    long                host_count, rank_count;
+} task_count_index_t;
+
+bool
+task_count_index_init(
+    task_count_index_t  *idx,
+    const char          *task_count_str
 )
 {
-    bool          has_count = false;
+    task_count_t        tc;
+    size_t              run_capacity = 0;
+    int                 value;
 
-    if ( strstr(format, "%c") || strstr(format, "%C") ) {
-        has_count = true;
-    } else {
-        const char  *s = format;
-
-        while ( (s = strstr(s, "%[")) ) {
-            s += 2;
-            while ( *s && (*s != ']') ) s++;
-            if ( *s == ']' ) {
-                s++;
-                if ( (*s == 'c') || (*s == 'C') ) {
-                    has_count = true;
-                    break;
-                }
+    idx->run = NULL;
+    idx->run_count = 0;
+    idx->host_count = idx->rank_count = 0;
+    task_count_init(&tc, task_count_str);
+    while ( (value = task_count_next(&tc)) >= 0 ) {
+        task_count_run_t    *run;
+
+        if ( idx->run_count == run_capacity ) {
+            task_count_run_t    *new_run;
+
+            run_capacity = run_capacity ? 2 * run_capacity : 16;
+            new_run = realloc(idx->run, run_capacity * sizeof(task_count_run_t));
+            if ( ! new_run ) {
+                fprintf(stderr, "FATAL:  unable to allocate memory for task count index\n");
+                exit(ENOMEM);
             }
+            idx->run = new_run;
         }
+        /* task_count_next() has taken one host of the run: */
+        run = &idx->run[idx->run_count++];
+        run->value = value;
+        run->count = tc.count + 1;
+        run->first_host = idx->host_count;
+        run->first_rank = idx->rank_count;
+        idx->host_count += run->count;
+        idx->rank_count += run->count * run->value;
+        tc.count = 0;
+    }
+    if ( *tc.cur_ptr ) {
+        /* task_count_next() has already explained the problem */
+        free(idx->run);
+        idx->run = NULL;
+        return false;
     }
+    return true;
+}
 
-    while ( true ) {
-        const char  *node_name = slurm_hostlist_shift(the_hostlist);
-        const char  *format_ptr = format;
-        int         task_count = -1;
+void
+task_count_index_destroy(
+    task_count_index_t  *idx
+)
+{
+    if ( idx->run ) free(idx->run);
+}
 
-        if ( ! node_name ) break;
-    
-        if ( slurm_hostlist_find(the_hostlist_exclusions, node_name) != -1 ) continue;
+/*
+ * Host index and local rank of global rank <rank>; returns false if there
+ * is no such rank.
+ */
+bool
+task_count_index_rank(
+    const task_count_index_t    *idx,
+    long                        rank,
+    long                        *host,
+    long                        *local_rank
+)
+{
+    size_t                      lo = 0, hi = idx->run_count;
+    const task_count_run_t      *run;
 
-        task_count = task_count_next(tc);
-        if ( task_count <= 0 ) break;
+    if ( (rank < 0) || (rank >= idx->rank_count) ) return false;
 
-        if ( has_count || no_repeats ) {
-            while ( *format_ptr ) {
-                switch ( *format_ptr ) {
+    /* The first run ending beyond the rank (runs of zero tasks end where
+     * they start, so they are never chosen):
+     */
+    while ( lo < hi ) {
+        size_t                  mid = lo + (hi - lo) / 2;
 
-                    case '%': {
-                        format_ptr++;
-                        switch ( *format_ptr ) {
+        run = &idx->run[mid];
+        if ( run->first_rank + run->count * run->value <= rank ) lo = mid + 1;
+        else hi = mid;
+    }
+    run = &idx->run[lo];
+    *host = run->first_host + (rank - run->first_rank) / run->value;
+    *local_rank = (rank - run->first_rank) % run->value;
+    return true;
+}
 
-                            case '%':
-                                fputc('%', stdout);
-                                format_ptr++;
-                                break;
+/*
+ * First global rank and number of ranks on host index <host>; returns
+ * false if the task counts do not cover that host.
+ */
+bool
+task_count_index_host(
+    const task_count_index_t    *idx,
+    long                        host,
+    long                        *first_rank,
+    long                        *rank_count
+)
+{
+    size_t                      lo = 0, hi = idx->run_count;
+    const task_count_run_t      *run;
 
-                            case 'h':
-                                fprintf(stdout, "%s", node_name);
-                                format_ptr++;
-                                break;
+    if ( (host < 0) || (host >= idx->host_count) ) return false;
+    while ( lo < hi ) {
+        size_t                  mid = lo + (hi - lo) / 2;
 
-                            case 'C':
-                                if ( task_count <= 1 ) {
-                                    format_ptr++;
-                                    break;
-                                }
-                            case 'c':
-                                fprintf(stdout, "%d", task_count);
-                                format_ptr++;
-                                break;
-
-                            case '[': {
-                                const char    *delim = ++format_ptr;
-                                int           delim_len = 0;
-
-                                while ( *format_ptr && (*format_ptr != ']') ) delim_len++, format_ptr++;
-                                if ( *format_ptr == ']' ) {
-                                    format_ptr++;
-                                    switch ( *format_ptr ) {
-
-                                        case 'C':
-                                            if ( task_count <= 1 ) {
-                                                format_ptr++;
-                                                break;
-                                            }
-                                        case 'c':
-                                            while ( delim_len-- ) fputc(*delim++, stdout);
-                                            fprintf(stdout, "%d", task_count);
-                                            format_ptr++;
-                                            break;
-
-                                        default:
-                                            format_ptr++;
-                                        case '\0':
-                                            break;
-                                    }
-                                } else {
-                                    fprintf(stderr, "ERROR:  invalid delimiter in format specification: %s\n", delim);
-                                    exit(EINVAL);
-                                }
-                                break;
-                            }
+        run = &idx->run[mid];
+        if ( run->first_host + run->count <= host ) lo = mid + 1;
+        else hi = mid;
+    }
+    run = &idx->run[lo];
+    *first_rank = run->first_rank + (host - run->first_host) * run->value;
+    *rank_count = run->value;
+    return true;
+}
 
-                            case '\0':
-                                break;
+//
 
-                            default:
-                                format_ptr++;
-                                break;
+/*
+ * Task distribution.  Ranks are dealt to the hosts in rounds:  in each
+ * round every host with tasks left takes up to <plane> more, as in
+ * Slurm's plane distribution (cyclic is a plane of 1, block a single
+ * round with no limit).  The tasks a host takes in a round depend only
+ * on its count, so every quantity is computed per run of the task count
+ * index rather than per rank.
+ *
+ * The weighted layout instead spreads each host's ranks evenly over the
+ * whole job, in proportion to its count:  task j of a host with count v
+ * sits at (2j + 1) / 2v, and ranks follow that order (ties in host order).
+ */
+#define DISTRIBUTION_WEIGHTED       -1
 
-                        }
-                        break;
-                    }
+/*
+ * The per-host form keeps one counter per round, so the largest count
+ * over the plane size is bounded:
+ */
+#define DISTRIBUTION_ROUND_MAX      (1L << 20)
 
-                    default:
-                        fputc(*format_ptr, stdout);
-                        format_ptr++;
-                        break;
-                }
-            }
-            fputc('\n', stdout);
-        } else {
-            while ( task_count-- ) {
-                format_ptr = format;
-                while ( *format_ptr ) {
-                    switch ( *format_ptr ) {
+static inline long
+distribution_round_tasks(
+    long            value,
+    long            plane,
+    long            round
+)
+{
+    long            left = value - round * plane;
 
-                        case '%': {
-                            format_ptr++;
-                            switch ( *format_ptr ) {
+    if ( left <= 0 ) return 0;
+    return (left < plane) ? left : plane;
+}
 
-                                case '%':
-                                    fputc('%', stdout);
-                                    format_ptr++;
-                                    break;
+/*
+ * Parse a layout name; a plane of 0 stands for block, and
+ * DISTRIBUTION_WEIGHTED for the weighted layout.
+ */
+bool
+distribution_from_string(
+    const char      *s,
+    long            *plane
+)
+{
+    if ( strcmp(s, "block") == 0 ) {
+        *plane = 0;
+    } else if ( strcmp(s, "cyclic") == 0 ) {
+        *plane = 1;
+    } else if ( strcmp(s, "weighted") == 0 ) {
+        *plane = DISTRIBUTION_WEIGHTED;
+    } else if ( strncmp(s, "plane=", 6) == 0 ) {
+        char        *end;
 
-                                case 'h':
-                                    fprintf(stdout, "%s", node_name);
-                                    format_ptr++;
-                                    break;
+        errno = 0;
+        *plane = strtol(s + 6, &end, 10);
+        if ( (end == s + 6) || *end || errno || (*plane < 1) ) {
+            fprintf(stderr, "ERROR:  invalid plane size: %s\n", s + 6);
+            return false;
+        }
+    } else {
+        fprintf(stderr, "ERROR:  unknown task distribution: %s\n", s);
+        return false;
+    }
+    return true;
+}
 
-                                case '\0':
-                                    break;
+void
+distribution_to_output(
+    output_t        *out,
+    long            plane
+)
+{
+    switch ( plane ) {
+        case 0:
+            output_puts(out, "block");
+            break;
+        case 1:
+            output_puts(out, "cyclic");
+            break;
+        case DISTRIBUTION_WEIGHTED:
+            output_puts(out, "weighted");
+            break;
+        default:
+            output_puts(out, "plane=");
+            output_int(out, plane);
+            break;
+    }
+}
 
-                                default:
-                                    format_ptr++;
-                                    break;
+//
 
-                            }
-                            break;
-                        }
+typedef enum {
+    snodelist_tasks_expand      = 0,
+    snodelist_tasks_compress    = 1,
+    snodelist_tasks_validate    = 2
+} snodelist_tasks_op;
 
-                        default:
-                            fputc(*format_ptr, stdout);
-                            format_ptr++;
-                            break;
-                    }
-                }
-                fputc('\n', stdout);
-            }
-        }
+static const char*  snodelist_tasks_op_strings[] = {
+                                                "expand",
+                                                "compress",
+                                                "validate",
+                                                NULL
+                                            };
+
+/*
+ * Run-length encoder for task counts:  runs are extended as counts
+ * arrive and written out when a different count ends them.
+ */
+typedef struct {
+    output_t        *out;
+    long            value, count;
+    bool            started;
+    bool            ok;
+} task_count_writer_t;
+
+void
+task_count_writer_flush(
+    task_count_writer_t *w
+)
+{
+    if ( w->count == 0 ) return;
+    if ( w->started ) output_putc(w->out, ',');
+    w->started = true;
+    output_int(w->out, w->value);
+    if ( w->count > 1 ) {
+        output_puts(w->out, "(x");
+        output_int(w->out, w->count);
+        output_putc(w->out, ')');
     }
+    w->count = 0;
 }
 
-//
+void
+task_count_writer_push(
+    task_count_writer_t *w,
+    long                value,
+    long                count
+)
+{
+    if ( count <= 0 ) return;
+    if ( w->count && (value != w->value) ) task_count_writer_flush(w);
+    w->value = value;
+    w->count += count;
+}
 
-int
-main(
-    int           argc,
-    char * const  argv[]
+/*
+ * An add_expression_fn:  each token holds counts in SLURM_TASKS_PER_NODE
+ * form (a bare list of counts is a special case of it).
+ */
+void
+task_count_writer_add(
+    void            *context,
+    const char      *expr,
+    size_t          expr_len
 )
 {
-    int               optc;
-    snodelist_mode    mode = snodelist_mode_default;
-    bool              do_uniq = false;
-    bool              did_include_an_env_var = false;
-    bool              no_repeats = false;
-    const char        *delimiter = snodelist_default_delimiter;
-    const char        *machinefile_format = "%h%[:]C";
-    HOSTLIST_T        hostlist = slurm_hostlist_create("");
-    HOSTLIST_T        hostlist_exclude = slurm_hostlist_create("");
+    task_count_writer_t *w = (task_count_writer_t*)context;
+    char                *str = strndup(expr, expr_len);
+    task_count_t        tc;
+    int                 value;
 
-    while ( (optc = getopt_long(argc, argv, snodelist_opts_string, snodelist_opts, NULL)) != -1 ) {
-        switch ( optc ) {
+    if ( ! str ) {
+        fprintf(stderr, "FATAL:  unable to allocate memory for task counts\n");
+        exit(ENOMEM);
+    }
+    task_count_init(&tc, str);
+    while ( (value = task_count_next(&tc)) >= 0 ) {
+        task_count_writer_push(w, value, tc.count + 1);
+        tc.count = 0;
+    }
+    if ( *tc.cur_ptr ) w->ok = false;
+    free(str);
+}
 
-            case 'h':
-                usage(argv[0]);
-                exit(0);
+//
 
-            case 'e':
-                mode = snodelist_mode_expand;
-                break;
+typedef enum {
+    snodelist_rank_query_host       = 0,
+    snodelist_rank_query_ranks      = 1,
+    snodelist_rank_query_local      = 2
+} snodelist_rank_query;
 
-            case 'c':
-                mode = snodelist_mode_compress;
-                break;
+//
 
-            case 'i': {
-                const char    *env_var_name;
+typedef struct {
+    snodelist_mode          mode;
+    snodelist_backend       backend;
+    unsigned                threads;
+    bool                    batch;
+    const char              *serve_socket;
+    const char              *job_cache_dir;
+    const char              *job_cache_clean_dir;
+    bool                    do_uniq, uniq_stable;
+    nodelist_sort_order     sort_order;
+    nodelist_set_op         set_op;
+    snodelist_select_t      select;
+    const char              *index_host;
+    const char              *first_rank_counts;
+    snodelist_rank_query    rank_query;
+    long                    rank;
+    const char              *rank_host;
+    long                    distribution_plane;
+    bool                    rankfile;
+    snodelist_tasks_op      tasks_op;
+    size_t                  split_count, split_size;
+    const char              *split_task_counts;
+    size_t                  tree_width;
+    bool                    tree_host;
+    bool                    no_repeats;
+    const char              *delimiter;
+    const char              *expand_format;
+    const char              *machinefile_format;
+    const char              *node_list;
+    const char              *task_count_list;
+    snodelist_sources_t     includes;
+    snodelist_sources_t     excludes;
+} snodelist_options_t;
 
-         if ( optc == ':' ) {
-                    env_var_name = "SLURM_JOB_NODELIST";
-                } else if ( optarg && *optarg ) {
-                    env_var_name = optarg;
-                } else {
-                    fprintf(stderr, "ERROR:  invalid variable name provided with -i/--include-env option\n");
-                    exit(EINVAL);
-                }
-                add_from_env(hostlist, env_var_name);
-                break;
-            }
+//
 
-            case 'l':
-                if ( optarg && *optarg ) {
-                    if ( ! add_from_file(hostlist, optarg) ) {
-                        exit(EINVAL);
-                    }
-                } else {
-                    fprintf(stderr, "ERROR:  invalid file path provided with -f/--nodelist option\n");
-                    exit(EINVAL);
-                }
-                break;
-    
-            case 'X':
-                if ( optarg && *optarg ) {
-                    add_from_env(hostlist_exclude, optarg);
-                } else {
-                    fprintf(stderr, "ERROR:  no variable name provided with -X/--exclude-env option\n");
-                    exit(EINVAL);
-                }
-                break;
-        
-            case 'x':
-                if ( optarg && *optarg ) {
-                    slurm_hostlist_push(hostlist_exclude, optarg);
+/*
+ * Host expressions are gathered from the environment, files, and the
+ * command line and handed to the selected backend through one of these.
+ * The expression is not necessarily NUL-terminated:  tokens read from a
+ * nodelist file point directly into the (mapped) file contents.
+ */
+typedef void (*add_expression_fn)(void *context, const char *expr, size_t expr_len);
+
+void
+add_to_hostlist(
+    void          *context,
+    const char    *expr,
+    size_t        expr_len
+)
+{
+    static char   *expr_copy = NULL;
+    static size_t expr_copy_len = 0;
+
+    /* The expression may end at the edge of a mapped file, so it is always
+     * copied rather than tested for a terminating NUL:
+     */
+    if ( expr_len >= expr_copy_len ) {
+        char    *new_expr_copy = realloc(expr_copy, expr_len + 1);
+
+        if ( ! new_expr_copy ) {
+            fprintf(stderr, "FATAL:  unable to allocate memory for host expression\n");
+            exit(ENOMEM);
+        }
+        expr_copy = new_expr_copy;
+        expr_copy_len = expr_len + 1;
+    }
+    memcpy(expr_copy, expr, expr_len);
+    expr_copy[expr_len] = '\0';
+    slurm_hostlist_push((HOSTLIST_T)context, expr_copy);
+}
+
+void
+add_to_nodelist(
+    void          *context,
+    const char    *expr,
+    size_t        expr_len
+)
+{
+    nodelist_push_len((nodelist_t*)context, expr, expr_len);
+}
+
+//
+
+void
+add_from_env(
+    add_expression_fn   add_expression,
+    void                *context,
+    const char          *env_var_name
+)
+{
+    char                *env_var_value = getenv(env_var_name);
+
+    if ( env_var_value ) add_expression(context, env_var_value, strlen(env_var_value));
+}
+
+//
+
+/*
+ * Whitespace is the C locale's isspace() set.  Token bytes are skipped a
+ * machine word at a time:  a word is only examined byte by byte once it
+ * holds some byte below '!' (which includes every whitespace character).
+ */
+static const bool   add_from_buffer_is_space[256] = {
+                        ['\t'] = true, ['\n'] = true, ['\v'] = true,
+                        ['\f'] = true, ['\r'] = true, [' '] = true
+                    };
+
+#define SWAR_ONES               0x0101010101010101ULL
+#define SWAR_HAS_BYTE_BELOW(W, N)   (((W) - SWAR_ONES * (N)) & ~(W) & (SWAR_ONES * 0x80))
+
+static inline const char*
+add_from_buffer_token_end(
+    const char    *p,
+    const char    *end
+)
+{
+    while ( end - p >= 8 ) {
+        uint64_t  w;
+
+        memcpy(&w, p, sizeof(w));
+        if ( SWAR_HAS_BYTE_BELOW(w, '!') ) break;
+        p += 8;
+    }
+    while ( (p < end) && ! add_from_buffer_is_space[(unsigned char)*p] ) p++;
+    return p;
+}
+
+void
+add_from_buffer(
+    add_expression_fn   add_expression,
+    void                *context,
+    const char          *buf,
+    size_t              buf_len
+)
+{
+    const char          *p = buf, *end = buf + buf_len;
+
+    while ( p < end ) {
+        const char      *s;
+
+        // Drop leading whitespace:
+        while ( (p < end) && add_from_buffer_is_space[(unsigned char)*p] ) p++;
+        if ( p == end ) break;
+        // A comment character, skip to the end of the line:
+        if ( *p == '#' ) {
+            p = memchr(p, '\n', end - p);
+            if ( ! p ) break;
+            continue;
+        }
+        s = p;
+        // Get past the next expression:
+        p = add_from_buffer_token_end(p, end);
+        add_expression(context, s, p - s);
+    }
+}
+
+//
+
+void
+add_from_stream(
+    add_expression_fn   add_expression,
+    void                *context,
+    FILE                *fptr
+)
+{
+    char                *line = NULL;
+    size_t              line_len = 0;
+    ssize_t             n;
+
+    while ( (n = getline(&line, &line_len, fptr)) > 0 ) add_from_buffer(add_expression, context, line, n);
+    if ( line ) free(line);
+}
+
+//
+
+bool
+add_from_file(
+    add_expression_fn   add_expression,
+    void                *context,
+    const char          *file
+)
+{
+    bool          rc = false;
+    FILE          *fptr = NULL;
+    struct stat   finfo;
+
+    if ( *file == '-' && *(file+1) == '\0' ) {
+        fptr = stdin;
+    } else {
+        int       fd = open(file, O_RDONLY);
+
+        if ( fd >= 0 ) {
+            /* Regular files are mapped and tokenized in place: */
+            if ( (fstat(fd, &finfo) == 0) && S_ISREG(finfo.st_mode) ) {
+                if ( finfo.st_size > 0 ) {
+                    void  *contents = mmap(NULL, finfo.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+                    if ( contents != MAP_FAILED ) {
+                        madvise(contents, finfo.st_size, MADV_SEQUENTIAL);
+                        add_from_buffer(add_expression, context, (const char*)contents, finfo.st_size);
+                        munmap(contents, finfo.st_size);
+                        close(fd);
+                        return true;
+                    }
                 } else {
-                    fprintf(stderr, "ERROR:  no host list provided with -x/--exclude option\n");
-                    exit(EINVAL);
+                    close(fd);
+                    return true;
                 }
-                break;
+            }
+            fptr = fdopen(fd, "r");
+            if ( ! fptr ) close(fd);
+        }
+    }
+    if ( fptr ) {
+        rc = true;
+        add_from_stream(add_expression, context, fptr);
+        if ( fptr != stdin ) fclose(fptr);
+    } else {
+        fprintf(stderr, "ERROR:  unable to open nodelist: %s\n", file);
+    }
+    return rc;
+}
 
-            case 'u':
-                do_uniq = true;
-                break;
+//
 
-            case 'd':
-                if ( ! optarg ) {
-                    fprintf(stderr, "ERROR:  no delimiter string provided with -d/--delimiter option\n");
-                    exit(EINVAL);
-                }
-                delimiter = optarg;
-                break;
+bool
+add_from_sources(
+    add_expression_fn           add_expression,
+    void                        *context,
+    const snodelist_sources_t   *sources
+)
+{
+    unsigned                    i;
 
-            case 'm':
-                mode = snodelist_mode_machinefile;
+    for ( i = 0; i < sources->count; i++ ) {
+        const snodelist_source_t  *source = &sources->list[i];
+
+        switch ( source->type ) {
+
+            case snodelist_source_expression:
+                add_expression(context, source->value, strlen(source->value));
                 break;
 
-            case 'f':
-                machinefile_format = optarg;
+            case snodelist_source_env:
+                add_from_env(add_expression, context, source->value);
                 break;
 
-            case 'n':
-                no_repeats = true;
+            case snodelist_source_file:
+                if ( ! add_from_file(add_expression, context, source->value) ) return false;
                 break;
 
         }
     }
+    return true;
+}
 
-    if ( mode == snodelist_mode_machinefile ) {
-        const char        *node_list, *task_count_list;
-        task_count_t      tc;
+//
+
+/*
+ * The native backend can read its sources on several threads.  The input
+ * is cut into units -- each expression or environment variable, each
+ * stream that cannot be mapped, and each mapped nodelist file in chunks
+ * that end on a line boundary -- and every unit is parsed into its own
+ * partial node list.  The partial lists are then appended in input order,
+ * so the result is the same as reading the sources one after another.
+ */
+#define ADD_FROM_CHUNK_MIN      (1024 * 1024)
 
-        slurm_hostlist_destroy(hostlist); hostlist = NULL;
+typedef struct {
+    const snodelist_source_t    *source;    /* an expression or environment variable */
+    FILE                        *fptr;      /* a stream that could not be mapped */
+    const char                  *buf;       /* a chunk of a mapped file */
+    size_t                      buf_len;
+    void                        *map;       /* the mapping, on a file's first chunk */
+    size_t                      map_len;
+    nodelist_t                  *nodes;
+} add_from_unit_t;
 
-        node_list = getenv("SLURM_JOB_NODELIST");
-        if ( ! node_list || ! *node_list ) {
-            fprintf(stderr, "ERROR:  no SLURM_JOB_NODELIST in environment\n");
-            exit(EINVAL);
+typedef struct {
+    add_from_unit_t             *unit;
+    unsigned                    unit_count, unit_capacity;
+    unsigned                    next_unit;
+    pthread_mutex_t             lock;
+} add_from_work_t;
+
+static add_from_unit_t*
+add_from_work_push(
+    add_from_work_t     *work
+)
+{
+    add_from_unit_t     *unit;
+
+    if ( work->unit_count == work->unit_capacity ) {
+        unsigned        new_capacity = work->unit_capacity ? 2 * work->unit_capacity : 16;
+        add_from_unit_t *new_unit = realloc(work->unit, new_capacity * sizeof(add_from_unit_t));
+
+        if ( ! new_unit ) {
+            fprintf(stderr, "FATAL:  unable to allocate memory for host list sources\n");
+            exit(ENOMEM);
         }
+        work->unit = new_unit;
+        work->unit_capacity = new_capacity;
+    }
+    unit = &work->unit[work->unit_count++];
+    memset(unit, 0, sizeof(add_from_unit_t));
+    return unit;
+}
 
-        task_count_list = getenv("SLURM_TASKS_PER_NODE");
-        if ( ! task_count_list || ! *task_count_list ) {
-            fprintf(stderr, "ERROR:  no SLURM_TASKS_PER_NODE in environment\n");
-            exit(EINVAL);
+/*
+ * Map a regular file and queue it in one chunk per thread (but no chunk
+ * smaller than ADD_FROM_CHUNK_MIN); anything else is queued as a stream.
+ * Returns false if the file could not be opened.
+ */
+static bool
+add_from_work_push_file(
+    add_from_work_t     *work,
+    const char          *file,
+    unsigned            thread_count,
+    bool                *used_stdin
+)
+{
+    int                 fd;
+    struct stat         finfo;
+    FILE                *fptr;
+
+    if ( *file == '-' && *(file+1) == '\0' ) {
+        /* Once stdin has been read to its end, later reads see nothing: */
+        if ( ! *used_stdin ) add_from_work_push(work)->fptr = stdin;
+        *used_stdin = true;
+        return true;
+    }
+    fd = open(file, O_RDONLY);
+    if ( fd < 0 ) {
+        fprintf(stderr, "ERROR:  unable to open nodelist: %s\n", file);
+        return false;
+    }
+    if ( (fstat(fd, &finfo) == 0) && S_ISREG(finfo.st_mode) ) {
+        size_t          len = finfo.st_size, start = 0;
+        size_t          chunk_len = (len + thread_count - 1) / thread_count;
+        void            *contents;
+
+        if ( len == 0 ) {
+            close(fd);
+            return true;
         }
-        task_count_init(&tc, task_count_list);
+        contents = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if ( contents != MAP_FAILED ) {
+            const char  *buf = (const char*)contents;
 
-        hostlist = slurm_hostlist_create(node_list);
-        if ( slurm_hostlist_count(hostlist) > 0 ) {
-            print_machinefile(hostlist, hostlist_exclude, &tc, machinefile_format, no_repeats);
+            madvise(contents, len, MADV_SEQUENTIAL);
+            close(fd);
+            if ( chunk_len < ADD_FROM_CHUNK_MIN ) chunk_len = ADD_FROM_CHUNK_MIN;
+            while ( start < len ) {
+                add_from_unit_t *unit = add_from_work_push(work);
+                size_t          end = len;
+
+                if ( len - start > chunk_len ) {
+                    const char  *eol = memchr(buf + start + chunk_len, '\n', len - start - chunk_len);
+
+                    end = eol ? (size_t)(eol - buf) + 1 : len;
+                }
+                if ( start == 0 ) {
+                    unit->map = contents;
+                    unit->map_len = len;
+                }
+                unit->buf = buf + start;
+                unit->buf_len = end - start;
+                start = end;
+            }
+            return true;
         }
+    }
+    fptr = fdopen(fd, "r");
+    if ( ! fptr ) {
+        close(fd);
+        fprintf(stderr, "ERROR:  unable to open nodelist: %s\n", file);
+        return false;
+    }
+    add_from_work_push(work)->fptr = fptr;
+    return true;
+}
+
+static void
+add_from_work_unit(
+    add_from_unit_t     *unit
+)
+{
+    unit->nodes = nodelist_create_partial();
+    if ( unit->buf ) {
+        add_from_buffer(add_to_nodelist, unit->nodes, unit->buf, unit->buf_len);
+    } else if ( unit->fptr ) {
+        add_from_stream(add_to_nodelist, unit->nodes, unit->fptr);
+    } else if ( unit->source->type == snodelist_source_env ) {
+        add_from_env(add_to_nodelist, unit->nodes, unit->source->value);
     } else {
-        if ( optind == argc && ! did_include_an_env_var ) add_from_env(hostlist, "SLURM_JOB_NODELIST");
+        add_to_nodelist(unit->nodes, unit->source->value, strlen(unit->source->value));
+    }
+}
 
-        while ( optind < argc ) {
-            slurm_hostlist_push(hostlist, argv[optind]);
-            optind++;
+static void*
+add_from_work_thread(
+    void                *context
+)
+{
+    add_from_work_t     *work = (add_from_work_t*)context;
+
+    while ( true ) {
+        unsigned        i;
+
+        pthread_mutex_lock(&work->lock);
+        i = work->next_unit++;
+        pthread_mutex_unlock(&work->lock);
+        if ( i >= work->unit_count ) break;
+        add_from_work_unit(&work->unit[i]);
+    }
+    return NULL;
+}
+
+bool
+add_from_sources_threaded(
+    nodelist_t                  *nodes,
+    const snodelist_sources_t   *sources,
+    unsigned                    thread_count
+)
+{
+    add_from_work_t             work;
+    pthread_t                   *threads = NULL;
+    unsigned                    i, threads_started = 0;
+    bool                        rc = true, used_stdin = false;
+
+    memset(&work, 0, sizeof(work));
+    pthread_mutex_init(&work.lock, NULL);
+
+    if ( thread_count == 0 ) thread_count = 1;
+    for ( i = 0; rc && (i < sources->count); i++ ) {
+        const snodelist_source_t  *source = &sources->list[i];
+
+        if ( source->type == snodelist_source_file ) {
+            rc = add_from_work_push_file(&work, source->value, thread_count, &used_stdin);
+        } else {
+            add_from_work_push(&work)->source = source;
         }
+    }
 
-        if ( slurm_hostlist_count(hostlist) > 0 ) {
-            if ( do_uniq ) slurm_hostlist_uniq(hostlist);
+    if ( rc ) {
+        if ( thread_count > work.unit_count ) thread_count = work.unit_count;
+        if ( thread_count > 1 ) {
+            threads = malloc((thread_count - 1) * sizeof(pthread_t));
+            if ( ! threads ) {
+                fprintf(stderr, "FATAL:  unable to allocate memory for threads\n");
+                exit(ENOMEM);
+            }
+            /* If a thread cannot be started, the others take up its share: */
+            while ( (threads_started < thread_count - 1) &&
+                    (pthread_create(&threads[threads_started], NULL, add_from_work_thread, &work) == 0) ) threads_started++;
+        }
+        add_from_work_thread(&work);
+        for ( i = 0; i < threads_started; i++ ) pthread_join(threads[i], NULL);
+        if ( threads ) free(threads);
+    }
 
-            switch ( mode ) {
+    for ( i = 0; i < work.unit_count; i++ ) {
+        add_from_unit_t *unit = &work.unit[i];
 
-                case snodelist_mode_expand: {
-                    char      *outNode;
-                    bool      showDelim = false;
+        if ( unit->nodes ) {
+            nodelist_append_list(nodes, unit->nodes);
+            nodelist_destroy(unit->nodes);
+        }
+        if ( unit->fptr && (unit->fptr != stdin) ) fclose(unit->fptr);
+        if ( unit->map ) munmap(unit->map, unit->map_len);
+    }
+    if ( work.unit ) free(work.unit);
+    pthread_mutex_destroy(&work.lock);
+    return rc;
+}
 
-                    while ( (outNode = slurm_hostlist_shift(hostlist)) ) {
-                        if ( slurm_hostlist_find(hostlist_exclude, outNode) == -1 ) {
-                            printf("%s%s", (showDelim ? delimiter : ""), outNode);
-                            showDelim = true;
-                        }
-                        free((void*)outNode);
-                    }
-                    fputc('\n', stdout);
-                    break;
-                }
+//
 
-                case snodelist_mode_compress: {
-                    char      *outList = NULL;
-          
-                    if ( slurm_hostlist_count(hostlist_exclude) == 0 ) {
-                        outList = GET_HOSTLIST_CSTR(hostlist);
-                    } else {
-                        HOSTLIST_T  filtered_hostlist = slurm_hostlist_create("");
-                        char        *outNode;
+/*
+ * A machinefile <line-format> is compiled once into a list of operations
+ * so that each host is emitted by walking the list rather than by
+ * re-interpreting the format string.
+ */
+typedef enum {
+    machinefile_op_literal          = 0,
+    machinefile_op_host             = 1,
+    machinefile_op_count            = 2,    /* %c and %[delim]c */
+    machinefile_op_optional_count   = 3     /* %C and %[delim]C, omitted if the count is 1 */
+} machinefile_op_type;
 
-                        while ( (outNode = slurm_hostlist_shift(hostlist)) ) {
-                            if ( slurm_hostlist_find(hostlist_exclude, outNode) == -1 ) {
-                                slurm_hostlist_push_host(filtered_hostlist, outNode);
+typedef struct {
+    machinefile_op_type     type;
+    size_t                  offset, len;    /* literal text or count delimiter in the text buffer */
+} machinefile_op_t;
+
+typedef struct {
+    char                    *text;
+    machinefile_op_t        *ops;
+    unsigned                op_count;
+    bool                    has_count;
+    size_t                  literal_len;    /* total length of the literal ops */
+    unsigned                host_op_count;
+    char                    *line;          /* scratch space for a rendered line */
+    size_t                  line_capacity;
+} machinefile_format_t;
+
+static void
+__machinefile_format_add_op(
+    machinefile_format_t    *mf,
+    machinefile_op_type     type,
+    size_t                  offset,
+    size_t                  len
+)
+{
+    if ( type == machinefile_op_literal ) {
+        if ( len == 0 ) return;
+        mf->literal_len += len;
+        /* Literal text is packed contiguously, so adjacent spans merge: */
+        if ( mf->op_count && (mf->ops[mf->op_count - 1].type == machinefile_op_literal) ) {
+            mf->ops[mf->op_count - 1].len += len;
+            return;
+        }
+    }
+    if ( type == machinefile_op_host ) mf->host_op_count++;
+    mf->ops[mf->op_count].type = type;
+    mf->ops[mf->op_count].offset = offset;
+    mf->ops[mf->op_count].len = len;
+    mf->op_count++;
+}
+
+bool
+machinefile_format_compile(
+    machinefile_format_t    *mf,
+    const char              *format
+)
+{
+    size_t                  format_len = strlen(format), text_len = 0;
+    const char              *format_ptr = format;
+
+    /* Neither the text nor the op list can outgrow the format itself: */
+    mf->text = malloc(format_len + 1);
+    mf->ops = malloc((format_len + 1) * sizeof(machinefile_op_t));
+    if ( ! mf->text || ! mf->ops ) {
+        fprintf(stderr, "FATAL:  unable to allocate memory for machinefile format\n");
+        exit(ENOMEM);
+    }
+    mf->op_count = 0;
+    mf->has_count = false;
+    mf->literal_len = 0;
+    mf->host_op_count = 0;
+    mf->line = NULL;
+    mf->line_capacity = 0;
+
+    while ( *format_ptr ) {
+        switch ( *format_ptr ) {
+
+            case '%': {
+                format_ptr++;
+                switch ( *format_ptr ) {
+
+                    case '%':
+                        mf->text[text_len] = '%';
+                        __machinefile_format_add_op(mf, machinefile_op_literal, text_len++, 1);
+                        format_ptr++;
+                        break;
+
+                    case 'h':
+                        __machinefile_format_add_op(mf, machinefile_op_host, 0, 0);
+                        format_ptr++;
+                        break;
+
+                    case 'C':
+                    case 'c':
+                        __machinefile_format_add_op(mf, (*format_ptr == 'C') ? machinefile_op_optional_count : machinefile_op_count, 0, 0);
+                        mf->has_count = true;
+                        format_ptr++;
+                        break;
+
+                    case '[': {
+                        const char    *delim = ++format_ptr;
+                        size_t        delim_len = 0;
+
+                        while ( *format_ptr && (*format_ptr != ']') ) delim_len++, format_ptr++;
+                        if ( *format_ptr == ']' ) {
+                            format_ptr++;
+                            switch ( *format_ptr ) {
+
+                                case 'C':
+                                case 'c':
+                                    /* The delimiter is stored apart from the literal text: */
+                                    memcpy(mf->text + text_len, delim, delim_len);
+                                    __machinefile_format_add_op(mf, (*format_ptr == 'C') ? machinefile_op_optional_count : machinefile_op_count, text_len, delim_len);
+                                    text_len += delim_len;
+                                    mf->has_count = true;
+                                    format_ptr++;
+                                    break;
+
+                                default:
+                                    format_ptr++;
+                                case '\0':
+                                    break;
                             }
-                            free((void*)outNode);
+                        } else {
+                            fprintf(stderr, "ERROR:  invalid delimiter in format specification: %s\n", delim);
+                            free(mf->text);
+                            free(mf->ops);
+                            return false;
                         }
-                        outList = GET_HOSTLIST_CSTR(filtered_hostlist);
-                        slurm_hostlist_destroy(filtered_hostlist);
-                    }
-                    if ( outList ) {
-                        printf("%s\n", outList);
-                        FREE_HOSTLIST_CSTR(outList);
+                        break;
                     }
-                    break;
-                }
 
-            }
-        }
-    }
-    slurm_hostlist_destroy(hostlist_exclude);
-    slurm_hostlist_destroy(hostlist);
+                    case '\0':
+                        break;
 
+                    default:
+                        format_ptr++;
+                        break;
+
+                }
+                break;
+            }
+
+            default: {
+                const char  *s = format_ptr;
+
+                while ( *format_ptr && (*format_ptr != '%') ) format_ptr++;
+                memcpy(mf->text + text_len, s, format_ptr - s);
+                __machinefile_format_add_op(mf, machinefile_op_literal, text_len, format_ptr - s);
+                text_len += format_ptr - s;
+                break;
+            }
+        }
+    }
+    /* Every line ends with a newline: */
+    mf->text[text_len] = '\n';
+    __machinefile_format_add_op(mf, machinefile_op_literal, text_len++, 1);
+    return true;
+}
+
+void
+machinefile_format_destroy(
+    machinefile_format_t    *mf
+)
+{
+    free(mf->text);
+    free(mf->ops);
+    if ( mf->line ) free(mf->line);
+}
+
+//
+
+/*
+ * Lines without a count token are repeated once per task; the line is
+ * rendered a single time and the copies are made by block duplication
+ * in the output buffer.
+ */
+static size_t
+__machinefile_format_render_line(
+    machinefile_format_t    *mf,
+    const char              *node_name,
+    size_t                  node_name_len
+)
+{
+    size_t                  line_len = mf->literal_len + mf->host_op_count * node_name_len, len = 0;
+    unsigned                i;
+
+    if ( line_len > mf->line_capacity ) {
+        char                *new_line = realloc(mf->line, line_len);
+
+        if ( ! new_line ) {
+            fprintf(stderr, "FATAL:  unable to allocate memory for machinefile line\n");
+            exit(ENOMEM);
+        }
+        mf->line = new_line;
+        mf->line_capacity = line_len;
+    }
+    for ( i = 0; i < mf->op_count; i++ ) {
+        const machinefile_op_t  *op = &mf->ops[i];
+
+        if ( op->type == machinefile_op_literal ) {
+            memcpy(mf->line + len, mf->text + op->offset, op->len);
+            len += op->len;
+        } else if ( op->type == machinefile_op_host ) {
+            memcpy(mf->line + len, node_name, node_name_len);
+            len += node_name_len;
+        }
+    }
+    return len;
+}
+
+void
+print_machinefile_host(
+    output_t                *out,
+    const char              *node_name,
+    size_t                  node_name_len,
+    int                     task_count,
+    machinefile_format_t    *mf,
+    bool                    no_repeats
+)
+{
+    const machinefile_op_t  *op = mf->ops, *op_end = mf->ops + mf->op_count;
+
+    if ( ! mf->has_count && ! no_repeats && (task_count > 1) ) {
+        output_repeat(out, mf->line, __machinefile_format_render_line(mf, node_name, node_name_len), task_count);
+        return;
+    }
+    while ( op < op_end ) {
+        switch ( op->type ) {
+
+            case machinefile_op_literal:
+                output_write(out, mf->text + op->offset, op->len);
+                break;
+
+            case machinefile_op_host:
+                output_write(out, node_name, node_name_len);
+                break;
+
+            case machinefile_op_optional_count:
+                if ( task_count <= 1 ) break;
+            case machinefile_op_count:
+                output_write(out, mf->text + op->offset, op->len);
+                output_int(out, task_count);
+                break;
+
+        }
+        op++;
+    }
+}
+
+//
+
+bool
+print_machinefile(
+    output_t                *out,
+    HOSTLIST_T              the_hostlist,
+    const nodelist_index_t  *the_exclusions,
+    task_count_t            *tc,
+    const char              *format,
+    bool                    no_repeats
+)
+{
+    machinefile_format_t    mf;
+
+    if ( ! machinefile_format_compile(&mf, format) ) return false;
+    while ( true ) {
+        char        *node_name = slurm_hostlist_shift(the_hostlist);
+        int         task_count;
+
+        if ( ! node_name ) break;
+
+        if ( nodelist_index_find(the_exclusions, node_name, strlen(node_name)) ) {
+            free((void*)node_name);
+            continue;
+        }
+
+        task_count = task_count_next(tc);
+        if ( task_count > 0 ) print_machinefile_host(out, node_name, strlen(node_name), task_count, &mf, no_repeats);
+        free((void*)node_name);
+        if ( task_count <= 0 ) break;
+    }
+    machinefile_format_destroy(&mf);
+    return true;
+}
+
+//
+
+bool
+print_machinefile_nodelist(
+    output_t                *out,
+    nodelist_t              *the_nodelist,
+    const nodelist_index_t  *the_exclusions,
+    task_count_t            *tc,
+    const char              *format,
+    bool                    no_repeats
+)
+{
+    machinefile_format_t    mf;
+    nodelist_iter_t         it;
+    const char              *node_name;
+    size_t                  node_name_len;
+
+    if ( ! machinefile_format_compile(&mf, format) ) return false;
+    nodelist_iter_init(&it, the_nodelist);
+    while ( (node_name = nodelist_iter_next(&it, &node_name_len)) ) {
+        int           task_count;
+
+        if ( nodelist_index_find(the_exclusions, node_name, node_name_len) ) continue;
+
+        task_count = task_count_next(tc);
+        if ( task_count <= 0 ) break;
+
+        print_machinefile_host(out, node_name, node_name_len, task_count, &mf, no_repeats);
+    }
+    nodelist_iter_destroy(&it);
+    machinefile_format_destroy(&mf);
+    return true;
+}
+
+//
+
+/*
+ * The expand format is likewise compiled once into a list of ops.  An
+ * arithmetic token keeps its variable in the op and its operator/operand
+ * terms in a separate array, evaluated left to right for each host.
+ */
+typedef enum {
+    expand_op_literal   = 0,
+    expand_op_host      = 1,    /* %h */
+    expand_op_index     = 2,    /* %i */
+    expand_op_number    = 3,    /* %n */
+    expand_op_prefix    = 4,    /* %p */
+    expand_op_width     = 5,    /* %w */
+    expand_op_expr      = 6     /* %{...} */
+} expand_op_type;
+
+typedef struct {
+    expand_op_type      type;
+    size_t              offset, len;    /* literal text, or span of the term array */
+    char                var;            /* for %{...}:  'n', 'i' or 'w' */
+} expand_op_t;
+
+typedef struct {
+    char                op;
+    long                value;
+} expand_term_t;
+
+typedef struct {
+    char                *text;
+    expand_op_t         *ops;
+    unsigned            op_count;
+    expand_term_t       *terms;
+    size_t              term_count;
+} expand_format_t;
+
+static void
+__expand_format_add_op(
+    expand_format_t     *ef,
+    expand_op_type      type,
+    size_t              offset,
+    size_t              len
+)
+{
+    /* Adjacent literal text joins the previous literal op: */
+    if ( (type == expand_op_literal) && ef->op_count && (ef->ops[ef->op_count - 1].type == expand_op_literal) ) {
+        ef->ops[ef->op_count - 1].len += len;
+        return;
+    }
+    ef->ops[ef->op_count].type = type;
+    ef->ops[ef->op_count].offset = offset;
+    ef->ops[ef->op_count].len = len;
+    ef->ops[ef->op_count].var = '\0';
+    ef->op_count++;
+}
+
+void
+expand_format_destroy(
+    expand_format_t     *ef
+)
+{
+    if ( ef->text ) free(ef->text);
+    if ( ef->ops ) free(ef->ops);
+    if ( ef->terms ) free(ef->terms);
+}
+
+/*
+ * Parse the body of a %{...} token at <p> into a new op; returns the
+ * character after the closing brace, or NULL if the body is invalid.
+ */
+static const char*
+__expand_format_expr(
+    expand_format_t     *ef,
+    const char          *p
+)
+{
+    size_t              first_term = ef->term_count;
+
+    if ( (*p != 'n') && (*p != 'i') && (*p != 'w') ) return NULL;
+    __expand_format_add_op(ef, expand_op_expr, first_term, 0);
+    ef->ops[ef->op_count - 1].var = *p++;
+    while ( *p && (*p != '}') ) {
+        expand_term_t   *term = &ef->terms[ef->term_count];
+        char            *end;
+
+        if ( ! strchr("+-*/%", *p) ) return NULL;
+        term->op = *p++;
+        if ( ! isdigit((unsigned char)*p) ) return NULL;
+        errno = 0;
+        term->value = strtol(p, &end, 10);
+        if ( errno || ((term->op == '/' || term->op == '%') && (term->value == 0)) ) return NULL;
+        p = end;
+        ef->term_count++;
+    }
+    if ( *p != '}' ) return NULL;
+    ef->ops[ef->op_count - 1].len = ef->term_count - first_term;
+    return p + 1;
+}
+
+bool
+expand_format_compile(
+    expand_format_t     *ef,
+    const char          *format
+)
+{
+    size_t              format_len = strlen(format), text_len = 0;
+    const char          *format_ptr = format;
+
+    /* Neither the text, the ops nor the terms can outgrow the format itself: */
+    ef->text = malloc(format_len + 1);
+    ef->ops = malloc((format_len + 1) * sizeof(expand_op_t));
+    ef->terms = malloc((format_len + 1) * sizeof(expand_term_t));
+    if ( ! ef->text || ! ef->ops || ! ef->terms ) {
+        fprintf(stderr, "FATAL:  unable to allocate memory for expand format\n");
+        exit(ENOMEM);
+    }
+    ef->op_count = 0;
+    ef->term_count = 0;
+
+    while ( *format_ptr ) {
+        if ( *format_ptr != '%' ) {
+            const char  *s = format_ptr;
+
+            while ( *format_ptr && (*format_ptr != '%') ) format_ptr++;
+            memcpy(ef->text + text_len, s, format_ptr - s);
+            __expand_format_add_op(ef, expand_op_literal, text_len, format_ptr - s);
+            text_len += format_ptr - s;
+            continue;
+        }
+        switch ( *(++format_ptr) ) {
+
+            case '%':
+                ef->text[text_len] = '%';
+                __expand_format_add_op(ef, expand_op_literal, text_len++, 1);
+                format_ptr++;
+                break;
+
+            case 'h':
+                __expand_format_add_op(ef, expand_op_host, 0, 0);
+                format_ptr++;
+                break;
+
+            case 'i':
+                __expand_format_add_op(ef, expand_op_index, 0, 0);
+                format_ptr++;
+                break;
+
+            case 'n':
+                __expand_format_add_op(ef, expand_op_number, 0, 0);
+                format_ptr++;
+                break;
+
+            case 'p':
+                __expand_format_add_op(ef, expand_op_prefix, 0, 0);
+                format_ptr++;
+                break;
+
+            case 'w':
+                __expand_format_add_op(ef, expand_op_width, 0, 0);
+                format_ptr++;
+                break;
+
+            case '{': {
+                const char  *next = __expand_format_expr(ef, format_ptr + 1);
+
+                if ( next ) {
+                    format_ptr = next;
+                    break;
+                }
+                fprintf(stderr, "ERROR:  invalid arithmetic in expand format: %s\n", format_ptr - 1);
+                expand_format_destroy(ef);
+                return false;
+            }
+
+            default:
+                fprintf(stderr, "ERROR:  invalid token in expand format: %s\n", format_ptr - 1);
+                expand_format_destroy(ef);
+                return false;
+
+        }
+    }
+    return true;
+}
+
+/*
+ * Write every host of <nodes> through the format, with <delimiter> between
+ * hosts.  Returns zero, or ERANGE (having reported it) if arithmetic
+ * overflows; write errors are left in <out>.
+ */
+int
+expand_format_write(
+    const expand_format_t   *ef,
+    const nodelist_t        *nodes,
+    const char              *delimiter,
+    output_t                *out
+)
+{
+    nodelist_iter_t         it;
+    const char              *host;
+    size_t                  host_len, delimiter_len = strlen(delimiter);
+    int                     rc = 0;
+
+    nodelist_iter_init(&it, nodes);
+    while ( (rc == 0) && out->ok && (host = nodelist_iter_next(&it, &host_len)) ) {
+        unsigned            i;
+
+        if ( it.position > 1 ) output_write(out, delimiter, delimiter_len);
+        for ( i = 0; i < ef->op_count; i++ ) {
+            const expand_op_t   *op = &ef->ops[i];
+
+            switch ( op->type ) {
+
+                case expand_op_literal:
+                    output_write(out, ef->text + op->offset, op->len);
+                    break;
+
+                case expand_op_host:
+                    output_write(out, host, host_len);
+                    break;
+
+                case expand_op_index:
+                    output_int(out, it.position - 1);
+                    break;
+
+                case expand_op_number:
+                    /* The suffix is whatever follows the prefix in the name: */
+                    output_write(out, host + it.prefix_len, host_len - it.prefix_len);
+                    break;
+
+                case expand_op_prefix:
+                    output_write(out, it.prefix, it.prefix_len);
+                    break;
+
+                case expand_op_width:
+                    output_int(out, it.host_padded_width);
+                    break;
+
+                case expand_op_expr: {
+                    long        v;
+                    size_t      t;
+                    bool        overflow = false;
+
+                    if ( op->var == 'n' ) {
+                        if ( ! it.host_digits ) break;
+                        v = it.host_num;
+                    } else {
+                        v = (op->var == 'i') ? (long)(it.position - 1) : it.host_padded_width;
+                    }
+                    for ( t = op->offset; ! overflow && (t < op->offset + op->len); t++ ) {
+                        const expand_term_t *term = &ef->terms[t];
+
+                        /* Operands are never negative, so only + - * can overflow: */
+                        switch ( term->op ) {
+                            case '+':   overflow = __builtin_add_overflow(v, term->value, &v); break;
+                            case '-':   overflow = __builtin_sub_overflow(v, term->value, &v); break;
+                            case '*':   overflow = __builtin_mul_overflow(v, term->value, &v); break;
+                            case '/':   v /= term->value; break;
+                            case '%':   v %= term->value; break;
+                        }
+                    }
+                    if ( overflow ) {
+                        fprintf(stderr, "ERROR:  arithmetic in expand format overflows for host %.*s\n", (int)host_len, host);
+                        rc = ERANGE;
+                        break;
+                    }
+                    output_int(out, v);
+                    break;
+                }
+
+            }
+        }
+    }
+    nodelist_iter_destroy(&it);
+    return rc;
+}
+
+//
+
+/*
+ * Reverse machinefile:  the compiled line format is used as a pattern.
+ * Literal text must match exactly; a host name runs up to whitespace or
+ * the first character of the text that follows it; a count is a run of
+ * digits (after its delimiter, if it has one), and an optional count
+ * that is absent is 1.  Trailing whitespace is ignored.  Returns false
+ * if the line does not match.
+ */
+bool
+machinefile_format_match(
+    const machinefile_format_t  *mf,
+    const char                  *line,
+    size_t                      line_len,
+    const char                  **host,
+    size_t                      *host_len,
+    long                        *count
+)
+{
+    size_t                      pos = 0;
+    unsigned                    i;
+
+    while ( line_len && isspace((unsigned char)line[line_len - 1]) ) line_len--;
+    *host = NULL;
+    *host_len = 0;
+    *count = 1;
+    for ( i = 0; i < mf->op_count; i++ ) {
+        const machinefile_op_t  *op = &mf->ops[i];
+        const char              *text = mf->text + op->offset;
+        size_t                  len = op->len;
+
+        switch ( op->type ) {
+
+            case machinefile_op_literal:
+                /* The format's closing newline is not part of the line: */
+                if ( i == mf->op_count - 1 ) len--;
+                if ( (line_len - pos < len) || memcmp(line + pos, text, len) ) return false;
+                pos += len;
+                break;
+
+            case machinefile_op_host: {
+                const machinefile_op_t  *next = (i + 1 < mf->op_count) ? &mf->ops[i + 1] : NULL;
+                char                    stop = (next && next->len) ? mf->text[next->offset] : '\0';
+
+                *host = line + pos;
+                while ( (pos < line_len) && ! isspace((unsigned char)line[pos]) && (line[pos] != stop) ) pos++;
+                *host_len = (line + pos) - *host;
+                if ( *host_len == 0 ) return false;
+                break;
+            }
+
+            case machinefile_op_count:
+            case machinefile_op_optional_count: {
+                size_t                  start;
+
+                if ( len && ((line_len - pos < len) || memcmp(line + pos, text, len)) ) {
+                    if ( op->type == machinefile_op_optional_count ) break;
+                    return false;
+                }
+                start = pos + len;
+                *count = 0;
+                while ( (start < line_len) && isdigit((unsigned char)line[start]) && (*count < INT_MAX) ) {
+                    *count = 10 * (*count) + (line[start++] - '0');
+                }
+                if ( start == pos + len ) {
+                    *count = 1;
+                    if ( op->type == machinefile_op_count || len ) return false;
+                    break;
+                }
+                pos = start;
+                break;
+            }
+
+        }
+    }
+    return (pos == line_len) && *host;
+}
+
+/*
+ * Per-host task totals, kept in order of first appearance and found by
+ * an open-addressing hash table of entry indices.
+ */
+typedef struct {
+    size_t          name_offset, name_len;
+    long            count;
+} host_count_entry_t;
+
+typedef struct {
+    char                *names;
+    size_t              names_len, names_capacity;
+    host_count_entry_t  *entry;
+    size_t              entry_count, entry_capacity;
+    size_t              *slot;          /* entry index + 1, or 0 */
+    size_t              slot_count;
+} host_count_table_t;
+
+static void*
+__host_count_realloc(
+    void            *ptr,
+    size_t          size
+)
+{
+    void            *new_ptr = realloc(ptr, size);
+
+    if ( ! new_ptr ) {
+        fprintf(stderr, "FATAL:  unable to allocate memory for host file\n");
+        exit(ENOMEM);
+    }
+    return new_ptr;
+}
+
+void
+host_count_table_add(
+    host_count_table_t  *table,
+    const char          *host,
+    size_t              host_len,
+    long                count
+)
+{
+    uint64_t            h = result_cache_hash(host, host_len);
+    size_t              i;
+
+    if ( 2 * (table->entry_count + 1) > table->slot_count ) {
+        /* Keep the table at most half full: */
+        size_t          new_slot_count = table->slot_count ? 2 * table->slot_count : 1024;
+
+        free(table->slot);
+        table->slot = calloc(new_slot_count, sizeof(size_t));
+        if ( ! table->slot ) {
+            fprintf(stderr, "FATAL:  unable to allocate memory for host file\n");
+            exit(ENOMEM);
+        }
+        table->slot_count = new_slot_count;
+        for ( i = 0; i < table->entry_count; i++ ) {
+            const host_count_entry_t    *e = &table->entry[i];
+            size_t                      j = result_cache_hash(table->names + e->name_offset, e->name_len) & (new_slot_count - 1);
+
+            while ( table->slot[j] ) j = (j + 1) & (new_slot_count - 1);
+            table->slot[j] = i + 1;
+        }
+    }
+
+    i = h & (table->slot_count - 1);
+    while ( table->slot[i] ) {
+        host_count_entry_t  *e = &table->entry[table->slot[i] - 1];
+
+        if ( (e->name_len == host_len) && (memcmp(table->names + e->name_offset, host, host_len) == 0) ) {
+            e->count += count;
+            return;
+        }
+        i = (i + 1) & (table->slot_count - 1);
+    }
+
+    if ( table->entry_count == table->entry_capacity ) {
+        table->entry_capacity = table->entry_capacity ? 2 * table->entry_capacity : 1024;
+        table->entry = __host_count_realloc(table->entry, table->entry_capacity * sizeof(host_count_entry_t));
+    }
+    while ( table->names_len + host_len > table->names_capacity ) {
+        table->names_capacity = table->names_capacity ? 2 * table->names_capacity : 16384;
+        table->names = __host_count_realloc(table->names, table->names_capacity);
+    }
+    memcpy(table->names + table->names_len, host, host_len);
+    table->entry[table->entry_count].name_offset = table->names_len;
+    table->entry[table->entry_count].name_len = host_len;
+    table->entry[table->entry_count].count = count;
+    table->names_len += host_len;
+    table->slot[i] = ++table->entry_count;
+}
+
+void
+host_count_table_destroy(
+    host_count_table_t  *table
+)
+{
+    if ( table->names ) free(table->names);
+    if ( table->entry ) free(table->entry);
+    if ( table->slot ) free(table->slot);
+}
+
+/*
+ * Stream one host file through the formats, adding each line's host and
+ * count (from the first of the <mf_count> formats it matches) to the
+ * table.  Blank lines and lines starting with '#' are skipped.
+ */
+bool
+hostfile_read(
+    host_count_table_t          *table,
+    const machinefile_format_t  *mf,
+    unsigned                    mf_count,
+    const nodelist_index_t      *exclusions,
+    const char                  *file
+)
+{
+    FILE                        *fptr = ( *file == '-' && *(file+1) == '\0' ) ? stdin : fopen(file, "r");
+    char                        *line = NULL;
+    size_t                      line_capacity = 0, line_no = 0;
+    ssize_t                     line_len;
+    bool                        rc = true;
+
+    if ( ! fptr ) {
+        fprintf(stderr, "ERROR:  unable to open host file: %s\n", file);
+        return false;
+    }
+    while ( (line_len = getline(&line, &line_capacity, fptr)) >= 0 ) {
+        const char              *p = line, *host;
+        size_t                  host_len;
+        long                    count;
+        unsigned                k = 0;
+
+        line_no++;
+        while ( isspace((unsigned char)*p) ) p++;
+        if ( ! *p || (*p == '#') ) continue;
+        while ( (k < mf_count) && ! machinefile_format_match(&mf[k], line, line_len, &host, &host_len, &count) ) k++;
+        if ( k == mf_count ) {
+            fprintf(stderr, "ERROR:  line %lu of %s does not match the format\n", (unsigned long)line_no, file);
+            rc = false;
+            break;
+        }
+        if ( ! nodelist_index_find(exclusions, host, host_len) ) host_count_table_add(table, host, host_len, count);
+    }
+    if ( line ) free(line);
+    if ( fptr != stdin ) fclose(fptr);
+    return rc;
+}
+
+int
+print_hostfile(
+    output_t                    *out,
+    const snodelist_options_t   *opts,
+    const nodelist_index_t      *exclusions
+)
+{
+    host_count_table_t          table;
+    machinefile_format_t        mf[2];
+    unsigned                    mf_count = 1;
+    int                         rc = 0;
+    unsigned                    i;
+
+    if ( ! machinefile_format_compile(&mf[0], opts->machinefile_format) ) return EINVAL;
+    if ( opts->machinefile_format == snodelist_default_machinefile_format ) {
+        /* Without -f the Open MPI form is accepted too: */
+        if ( ! machinefile_format_compile(&mf[1], "%h slots=%c") ) {
+            machinefile_format_destroy(&mf[0]);
+            return EINVAL;
+        }
+        mf_count = 2;
+    }
+    memset(&table, 0, sizeof(table));
+    for ( i = 0; (rc == 0) && (i < opts->includes.count); i++ ) {
+        if ( ! hostfile_read(&table, mf, mf_count, exclusions, opts->includes.list[i].value) ) rc = EINVAL;
+    }
+    if ( (rc == 0) && table.entry_count ) {
+        /* The hosts stay in order of first appearance, to match the counts: */
+        nodelist_t              *nodes = nodelist_create();
+        task_count_writer_t     w;
+        char                    *outList;
+        size_t                  k;
+
+        for ( k = 0; k < table.entry_count; k++ ) {
+            nodelist_push_host(nodes, table.names + table.entry[k].name_offset, table.entry[k].name_len);
+        }
+        outList = nodelist_ranged_string(nodes);
+        output_puts(out, outList);
+        output_putc(out, '\n');
+        free(outList);
+        nodelist_destroy(nodes);
+
+        w.out = out;
+        w.value = w.count = 0;
+        w.started = false;
+        w.ok = true;
+        for ( k = 0; k < table.entry_count; k++ ) task_count_writer_push(&w, table.entry[k].count, 1);
+        task_count_writer_flush(&w);
+        output_putc(out, '\n');
+    }
+    host_count_table_destroy(&table);
+    for ( i = 0; i < mf_count; i++ ) machinefile_format_destroy(&mf[i]);
+    return rc;
+}
+
+//
+
+/*
+ * The exclusions are parsed by Slurm but then indexed natively, so each
+ * membership test is a binary search rather than a slurm_hostlist_find()
+ * scan of the whole exclusion list.
+ */
+nodelist_t*
+hostlist_to_nodelist(
+    HOSTLIST_T      the_hostlist
+)
+{
+    nodelist_t      *the_nodelist = nodelist_create();
+    char            *node_name;
+
+    while ( (node_name = slurm_hostlist_shift(the_hostlist)) ) {
+        nodelist_push_host(the_nodelist, node_name, strlen(node_name));
+        free((void*)node_name);
+    }
+    return the_nodelist;
+}
+
+//
+
+/*
+ * The host index-of mode looks for:  the one named by the options, or
+ * this host's name (written to <hostname>).  Returns NULL if the name of
+ * this host cannot be had.
+ */
+const char*
+snodelist_index_host(
+    const snodelist_options_t   *opts,
+    char                        hostname[HOST_NAME_MAX + 1]
+)
+{
+    if ( opts->index_host ) return opts->index_host;
+    if ( gethostname(hostname, HOST_NAME_MAX + 1) != 0 ) {
+        fprintf(stderr, "ERROR:  unable to get the name of this host (errno = %d)\n", errno);
+        return NULL;
+    }
+    hostname[HOST_NAME_MAX] = '\0';
+    return hostname;
+}
+
+//
+
+typedef bool (*find_host_fn)(void *context, const char *host, size_t host_len, size_t *position);
+
+/*
+ * Index-of mode:  look up the host (by default, this host) using the
+ * backend's <find_host>, and write its position and optionally the rank
+ * of its first task.  A fully-qualified name that is not in the list is
+ * looked up again in its short form.
+ */
+int
+print_index_of(
+    output_t                    *out,
+    const snodelist_options_t   *opts,
+    find_host_fn                find_host,
+    void                        *context
+)
+{
+    char                        hostname[HOST_NAME_MAX + 1];
+    const char                  *host = snodelist_index_host(opts, hostname), *dot;
+    size_t                      position;
+    long                        rank = 0;
+    bool                        found;
+
+    if ( ! host ) return EINVAL;
+    found = find_host(context, host, strlen(host), &position);
+    if ( ! found && (dot = strchr(host, '.')) && (dot > host) ) found = find_host(context, host, dot - host, &position);
+    if ( ! found ) {
+        fprintf(stderr, "ERROR:  %s is not in the node list\n", host);
+        return ENOENT;
+    }
+
+    if ( opts->first_rank_counts ) {
+        task_count_t            tc;
+
+        task_count_init(&tc, opts->first_rank_counts);
+        if ( ! task_count_sum(&tc, position, &rank) ) {
+            fprintf(stderr, "ERROR:  task counts do not cover %lu hosts: %s\n", (unsigned long)position, opts->first_rank_counts);
+            return EINVAL;
+        }
+    }
+    output_int(out, position);
+    if ( opts->first_rank_counts ) {
+        output_putc(out, ' ');
+        output_int(out, rank);
+    }
+    output_putc(out, '\n');
+    return 0;
+}
+
+//
+
+/*
+ * The hosts of <hostlist> that are not excluded and fall within the
+ * selection, as a new host list; <hostlist> is left empty.  Returns NULL
+ * if an exact selection is not in the list.
+ */
+HOSTLIST_T
+hostlist_select(
+    HOSTLIST_T                  hostlist,
+    const nodelist_index_t      *exclusion_index,
+    const snodelist_select_t    *select
+)
+{
+    HOSTLIST_T                  filtered_hostlist = slurm_hostlist_create("");
+    HOSTLIST_T                  selected_hostlist;
+    char                        *outNode;
+    size_t                      start = 0, end, i = 0;
+
+    while ( (outNode = slurm_hostlist_shift(hostlist)) ) {
+        if ( ! nodelist_index_find(exclusion_index, outNode, strlen(outNode)) ) {
+            slurm_hostlist_push_host(filtered_hostlist, outNode);
+        }
+        free((void*)outNode);
+    }
+    end = slurm_hostlist_count(filtered_hostlist);
+    if ( ! select->active ) return filtered_hostlist;
+
+    if ( ! snodelist_select_resolve(select, end, &start, &end) ) {
+        slurm_hostlist_destroy(filtered_hostlist);
+        return NULL;
+    }
+    selected_hostlist = slurm_hostlist_create("");
+    while ( (outNode = slurm_hostlist_shift(filtered_hostlist)) ) {
+        if ( (i >= start) && (i < end) ) slurm_hostlist_push_host(selected_hostlist, outNode);
+        free((void*)outNode);
+        i++;
+    }
+    slurm_hostlist_destroy(filtered_hostlist);
+    return selected_hostlist;
+}
+
+static bool
+hostlist_find_host(
+    void            *context,
+    const char      *host,
+    size_t          host_len,
+    size_t          *position
+)
+{
+    char            *name = strndup(host, host_len);
+    int             i;
+
+    if ( ! name ) {
+        fprintf(stderr, "FATAL:  unable to allocate memory for host name\n");
+        exit(ENOMEM);
+    }
+    i = slurm_hostlist_find((HOSTLIST_T)context, name);
+    free(name);
+    if ( i < 0 ) return false;
+    *position = i;
+    return true;
+}
+
+//
+
+int
+snodelist_run_slurm(
+    const snodelist_options_t   *opts,
+    output_t                    *out
+)
+{
+    HOSTLIST_T                  hostlist = slurm_hostlist_create("");
+    HOSTLIST_T                  hostlist_exclude = slurm_hostlist_create("");
+    nodelist_t                  *nodes_exclude;
+    nodelist_index_t            *exclusion_index;
+    int                         rc = 0;
+
+    if ( ! add_from_sources(add_to_hostlist, hostlist_exclude, &opts->excludes) ) {
+        slurm_hostlist_destroy(hostlist_exclude);
+        slurm_hostlist_destroy(hostlist);
+        return EINVAL;
+    }
+    nodes_exclude = hostlist_to_nodelist(hostlist_exclude);
+    exclusion_index = nodelist_index_create(nodes_exclude);
+
+    if ( opts->mode == snodelist_mode_machinefile ) {
+        task_count_t      tc;
+
+        task_count_init(&tc, opts->task_count_list);
+
+        slurm_hostlist_push(hostlist, opts->node_list);
+        if ( slurm_hostlist_count(hostlist) > 0 ) {
+            if ( ! print_machinefile(out, hostlist, exclusion_index, &tc, opts->machinefile_format, opts->no_repeats) ) rc = EINVAL;
+        }
+    } else if ( ! add_from_sources(add_to_hostlist, hostlist, &opts->includes) ) {
+        rc = EINVAL;
+    } else {
+        if ( slurm_hostlist_count(hostlist) > 0 ) {
+            if ( opts->do_uniq ) slurm_hostlist_uniq(hostlist);
+            if ( opts->select.active || (((opts->mode == snodelist_mode_count) || (opts->mode == snodelist_mode_index)) &&
+                        nodelist_count(nodes_exclude)) ) {
+                HOSTLIST_T    selected_hostlist = hostlist_select(hostlist, exclusion_index, &opts->select);
+
+                slurm_hostlist_destroy(hostlist);
+                hostlist = selected_hostlist ? selected_hostlist : slurm_hostlist_create("");
+                if ( ! selected_hostlist ) rc = EINVAL;
+            }
+
+            if ( rc ) {
+                /* The selected host is not in the list */
+            } else if ( opts->select.active && (slurm_hostlist_count(hostlist) == 0) &&
+                        ((opts->mode == snodelist_mode_expand) || (opts->mode == snodelist_mode_compress)) ) {
+                /* An empty selection prints nothing */
+            } else switch ( opts->mode ) {
+
+                case snodelist_mode_expand: {
+                    char      *outNode;
+                    bool      showDelim = false;
+
+                    while ( (outNode = slurm_hostlist_shift(hostlist)) ) {
+                        if ( ! nodelist_index_find(exclusion_index, outNode, strlen(outNode)) ) {
+                            if ( showDelim ) output_puts(out, opts->delimiter);
+                            output_puts(out, outNode);
+                            showDelim = true;
+                        }
+                        free((void*)outNode);
+                    }
+                    output_putc(out, '\n');
+                    break;
+                }
+
+                case snodelist_mode_compress: {
+                    char      *outList = NULL;
+
+                    if ( nodelist_count(nodes_exclude) == 0 ) {
+                        outList = GET_HOSTLIST_CSTR(hostlist);
+                    } else {
+                        HOSTLIST_T  filtered_hostlist = slurm_hostlist_create("");
+                        char        *outNode;
+
+                        while ( (outNode = slurm_hostlist_shift(hostlist)) ) {
+                            if ( ! nodelist_index_find(exclusion_index, outNode, strlen(outNode)) ) {
+                                slurm_hostlist_push_host(filtered_hostlist, outNode);
+                            }
+                            free((void*)outNode);
+                        }
+                        outList = GET_HOSTLIST_CSTR(filtered_hostlist);
+                        slurm_hostlist_destroy(filtered_hostlist);
+                    }
+                    if ( outList ) {
+                        output_puts(out, outList);
+                        output_putc(out, '\n');
+                        FREE_HOSTLIST_CSTR(outList);
+                    }
+                    break;
+                }
+
+                case snodelist_mode_count:
+                    output_int(out, slurm_hostlist_count(hostlist));
+                    output_putc(out, '\n');
+                    break;
+
+                case snodelist_mode_index:
+                    rc = print_index_of(out, opts, hostlist_find_host, hostlist);
+                    break;
+
+                default:
+                    break;
+
+            }
+        } else if ( opts->select.exact ) {
+            size_t      start, end;
+
+            if ( ! snodelist_select_resolve(&opts->select, 0, &start, &end) ) rc = EINVAL;
+        } else if ( opts->mode == snodelist_mode_count ) {
+            output_puts(out, "0\n");
+        } else if ( opts->mode == snodelist_mode_index ) {
+            rc = print_index_of(out, opts, hostlist_find_host, hostlist);
+        }
+    }
+    nodelist_index_destroy(exclusion_index);
+    nodelist_destroy(nodes_exclude);
+    slurm_hostlist_destroy(hostlist_exclude);
+    slurm_hostlist_destroy(hostlist);
+
+    return rc;
+}
+
+//
+
+/*
+ * With a set operator each include source is an operand of its own:  each
+ * is read into a separate list and combined with the result so far (the
+ * first is combined with the empty list, which makes it a proper set).
+ */
+bool
+add_from_operands(
+    nodelist_t                  *nodes,
+    const snodelist_options_t   *opts
+)
+{
+    unsigned                    i;
+    bool                        rc = true;
+
+    for ( i = 0; rc && (i < opts->includes.count); i++ ) {
+        snodelist_sources_t     operand;
+        nodelist_t              *other = nodelist_create();
+
+        operand.list = &opts->includes.list[i];
+        operand.count = operand.capacity = 1;
+        rc = add_from_sources_threaded(other, &operand, opts->threads);
+        if ( rc ) nodelist_combine(nodes, other, i ? opts->set_op : nodelist_set_union);
+        nodelist_destroy(other);
+    }
+    return rc;
+}
+
+/*
+ * Rank mode:  answer one of the rank queries from the task count index
+ * and the job's node list.
+ */
+int
+print_rank_query(
+    output_t                    *out,
+    const snodelist_options_t   *opts,
+    nodelist_t                  *nodes
+)
+{
+    task_count_index_t          tci;
+    long                        host, local_rank, first_rank, rank_count;
+    size_t                      position;
+    int                         rc = 0;
+
+    if ( ! task_count_index_init(&tci, opts->task_count_list) ) return EINVAL;
+
+    switch ( opts->rank_query ) {
+
+        case snodelist_rank_query_host:
+        case snodelist_rank_query_local:
+            if ( ! task_count_index_rank(&tci, opts->rank, &host, &local_rank) ) {
+                fprintf(stderr, "ERROR:  rank %ld is not in the job (%ld ranks)\n", opts->rank, tci.rank_count);
+                rc = EINVAL;
+            } else if ( opts->rank_query == snodelist_rank_query_local ) {
+                output_int(out, local_rank);
+                output_putc(out, '\n');
+            } else if ( (size_t)host >= nodelist_count(nodes) ) {
+                fprintf(stderr, "ERROR:  task counts cover more hosts than the node list\n");
+                rc = EINVAL;
+            } else {
+                nodelist_slice(nodes, host, host + 1);
+                nodelist_expand(nodes, "", 0, out);
+                output_putc(out, '\n');
+            }
+            break;
+
+        case snodelist_rank_query_ranks:
+            if ( ! nodelist_position(nodes, opts->rank_host, strlen(opts->rank_host), &position) ) {
+                fprintf(stderr, "ERROR:  %s is not in the node list\n", opts->rank_host);
+                rc = ENOENT;
+            } else if ( ! task_count_index_host(&tci, position, &first_rank, &rank_count) ) {
+                fprintf(stderr, "ERROR:  task counts do not cover %lu hosts: %s\n", (unsigned long)position + 1, opts->task_count_list);
+                rc = EINVAL;
+            } else if ( rank_count > 0 ) {
+                output_int(out, first_rank);
+                if ( rank_count > 1 ) {
+                    output_putc(out, '-');
+                    output_int(out, first_rank + rank_count - 1);
+                }
+                output_putc(out, '\n');
+            } else {
+                output_putc(out, '\n');
+            }
+            break;
+
+    }
+    task_count_index_destroy(&tci);
+    return rc;
+}
+
+//
+
+static void
+rank_range_output(
+    output_t        *out,
+    char            separator,
+    long            lo,
+    long            hi
+)
+{
+    output_putc(out, separator);
+    output_int(out, lo);
+    if ( hi > lo ) {
+        output_putc(out, '-');
+        output_int(out, hi);
+    }
+}
+
+/*
+ * Weighted layout.  The events (run i, task j) are ordered by (2j + 1) / 2v
+ * and then by run; each event gives every host of the run one rank.  The
+ * rank of task j on the first host of run i is the number of ranks in the
+ * events before it, counted per run in O(runs).
+ */
+static inline bool
+distribution_weighted_before(
+    const task_count_index_t    *tci,
+    size_t                      a,
+    long                        ja,
+    size_t                      b,
+    long                        jb
+)
+{
+    unsigned long               fa = (2 * (unsigned long)ja + 1) * tci->run[b].value;
+    unsigned long               fb = (2 * (unsigned long)jb + 1) * tci->run[a].value;
+
+    return (fa < fb) || ((fa == fb) && (a < b));
+}
+
+static long
+distribution_weighted_rank(
+    const task_count_index_t    *tci,
+    size_t                      i,
+    long                        j
+)
+{
+    long                        v = tci->run[i].value, rank = 0;
+    size_t                      r;
+
+    for ( r = 0; r < tci->run_count; r++ ) {
+        unsigned long           a = (2 * (unsigned long)j + 1) * tci->run[r].value;
+        long                    n;
+
+        if ( tci->run[r].value == 0 ) continue;
+        /* Tasks j' of run r with (2j' + 1) v < a (or <= a for earlier runs): */
+        n = (long)((((r < i) ? a : a - 1) / v + 1) / 2);
+        if ( n > tci->run[r].value ) n = tci->run[r].value;
+        rank += n * tci->run[r].count;
+    }
+    return rank;
+}
+
+static int
+print_distribution_weighted(
+    output_t                    *out,
+    const snodelist_options_t   *opts,
+    const nodelist_t            *nodes,
+    const task_count_index_t    *tci
+)
+{
+    size_t                      i;
+
+    if ( opts->rankfile ) {
+        /* A heap of the runs ordered by their next event: */
+        size_t                  *heap = malloc((tci->run_count + 1) * sizeof(size_t)), heap_count = 0;
+        long                    *next = calloc(tci->run_count + 1, sizeof(long)), rank = 0;
+        char                    *host = malloc(nodelist_host_len_max(nodes) + 1);
+        nodelist_locator_t      loc;
+
+        if ( ! heap || ! next || ! host ) {
+            fprintf(stderr, "FATAL:  unable to allocate memory for task distribution\n");
+            exit(ENOMEM);
+        }
+        nodelist_locator_init(&loc, nodes);
+        for ( i = 0; i < tci->run_count; i++ ) {
+            size_t              c = heap_count++;
+
+            if ( tci->run[i].value == 0 ) {
+                heap_count--;
+                continue;
+            }
+            while ( c && distribution_weighted_before(tci, i, 0, heap[(c - 1) / 2], next[heap[(c - 1) / 2]]) ) {
+                heap[c] = heap[(c - 1) / 2];
+                c = (c - 1) / 2;
+            }
+            heap[c] = i;
+        }
+        while ( heap_count ) {
+            const task_count_run_t  *run = &tci->run[heap[0]];
+            long                    j = next[heap[0]], h;
+            size_t                  top = heap[0], c = 0;
+
+            for ( h = 0; h < run->count; h++ ) {
+                size_t          host_len = nodelist_locator_render(&loc, run->first_host + h, host);
+
+                output_puts(out, "rank ");
+                output_int(out, rank++);
+                output_putc(out, '=');
+                output_write(out, host, host_len);
+                output_puts(out, " slot=");
+                output_int(out, j);
+                output_putc(out, '\n');
+            }
+            /* Sift the run (or the last entry, once the run is done) down: */
+            if ( ++next[top] == run->value ) top = heap[--heap_count];
+            while ( 2 * c + 1 < heap_count ) {
+                size_t          k = 2 * c + 1;
+
+                if ( (k + 1 < heap_count) && distribution_weighted_before(tci, heap[k + 1], next[heap[k + 1]], heap[k], next[heap[k]]) ) k++;
+                if ( ! distribution_weighted_before(tci, heap[k], next[heap[k]], top, next[top]) ) break;
+                heap[c] = heap[k];
+                c = k;
+            }
+            if ( heap_count ) heap[c] = top;
+        }
+        nodelist_locator_destroy(&loc);
+        free(host);
+        free(next);
+        free(heap);
+    } else {
+        nodelist_iter_t         it;
+
+        nodelist_iter_init(&it, nodes);
+        for ( i = 0; i < tci->run_count; i++ ) {
+            const task_count_run_t  *run = &tci->run[i];
+            long                    h, j;
+
+            for ( h = 0; h < run->count; h++ ) {
+                size_t              host_len;
+                const char          *host = nodelist_iter_next(&it, &host_len);
+                long                lo = -1, hi = -2;
+                char                separator = ' ';
+
+                if ( run->value == 0 ) continue;
+                output_write(out, host, host_len);
+                for ( j = 0; j < run->value; j++ ) {
+                    long            rank = distribution_weighted_rank(tci, i, j) + h;
+
+                    if ( rank != hi + 1 ) {
+                        if ( lo >= 0 ) {
+                            rank_range_output(out, separator, lo, hi);
+                            separator = ',';
+                        }
+                        lo = rank;
+                    }
+                    hi = rank;
+                }
+                rank_range_output(out, separator, lo, hi);
+                output_putc(out, '\n');
+            }
+        }
+        nodelist_iter_destroy(&it);
+    }
+    return 0;
+}
+
+/*
+ * Distribution mode.  As a rankfile, the rounds are replayed in rank
+ * order (each round walks the runs, seeking the host iterator forward to
+ * each).  Otherwise each host is written with its ranks as ranges:  the
+ * rank the next host starts at in each round is kept per round, so the
+ * memory needed grows with the number of rounds, not of ranks.
+ */
+int
+print_distribution(
+    output_t                    *out,
+    const snodelist_options_t   *opts,
+    const nodelist_t            *nodes
+)
+{
+    task_count_index_t          tci;
+    nodelist_iter_t             it;
+    long                        plane = opts->distribution_plane, value_max = 0, round_count, k;
+    size_t                      i;
+
+    if ( ! task_count_index_init(&tci, opts->task_count_list) ) return EINVAL;
+    if ( (size_t)tci.host_count > nodelist_count(nodes) ) {
+        fprintf(stderr, "ERROR:  task counts cover more hosts than the node list\n");
+        task_count_index_destroy(&tci);
+        return EINVAL;
+    }
+    if ( plane == DISTRIBUTION_WEIGHTED ) {
+        int                     rc = print_distribution_weighted(out, opts, nodes, &tci);
+
+        task_count_index_destroy(&tci);
+        return rc;
+    }
+    for ( i = 0; i < tci.run_count; i++ ) {
+        if ( tci.run[i].value > value_max ) value_max = tci.run[i].value;
+    }
+    if ( plane == 0 ) plane = value_max ? value_max : 1;
+    round_count = (value_max + plane - 1) / plane;
+    if ( ! opts->rankfile && (round_count > DISTRIBUTION_ROUND_MAX) ) {
+        fprintf(stderr, "ERROR:  a task count of %ld makes %ld rounds of this distribution (at most %ld)\n",
+                        value_max, round_count, DISTRIBUTION_ROUND_MAX);
+        task_count_index_destroy(&tci);
+        return EINVAL;
+    }
+
+    nodelist_iter_init(&it, nodes);
+    if ( opts->rankfile ) {
+        long                    rank = 0;
+
+        for ( k = 0; k < round_count; k++ ) {
+            for ( i = 0; i < tci.run_count; i++ ) {
+                const task_count_run_t  *run = &tci.run[i];
+                long                    n = distribution_round_tasks(run->value, plane, k), h, t;
+
+                if ( n == 0 ) continue;
+                nodelist_iter_seek(&it, run->first_host);
+                for ( h = 0; h < run->count; h++ ) {
+                    size_t              host_len;
+                    const char          *host = nodelist_iter_next(&it, &host_len);
+
+                    for ( t = 0; t < n; t++ ) {
+                        output_puts(out, "rank ");
+                        output_int(out, rank++);
+                        output_putc(out, '=');
+                        output_write(out, host, host_len);
+                        output_puts(out, " slot=");
+                        output_int(out, k * plane + t);
+                        output_putc(out, '\n');
+                    }
+                }
+            }
+        }
+    } else {
+        long                    *round_start = calloc(round_count ? round_count : 1, sizeof(long));
+
+        if ( ! round_start ) {
+            fprintf(stderr, "FATAL:  unable to allocate memory for task distribution\n");
+            exit(ENOMEM);
+        }
+        /* Rounds start where the ones before them left off: */
+        for ( k = 1; k < round_count; k++ ) {
+            round_start[k] = round_start[k - 1];
+            for ( i = 0; i < tci.run_count; i++ ) {
+                round_start[k] += tci.run[i].count * distribution_round_tasks(tci.run[i].value, plane, k - 1);
+            }
+        }
+        for ( i = 0; i < tci.run_count; i++ ) {
+            const task_count_run_t  *run = &tci.run[i];
+            long                    h;
+
+            for ( h = 0; h < run->count; h++ ) {
+                size_t              host_len;
+                const char          *host = nodelist_iter_next(&it, &host_len);
+                long                lo = -1, hi = -2, n;
+                char                separator = ' ';
+
+                if ( run->value == 0 ) continue;
+                output_write(out, host, host_len);
+                for ( k = 0; (k < round_count) && (n = distribution_round_tasks(run->value, plane, k)); k++ ) {
+                    /* Coalesce with the ranks taken in the round before: */
+                    if ( round_start[k] != hi + 1 ) {
+                        if ( lo >= 0 ) {
+                            rank_range_output(out, separator, lo, hi);
+                            separator = ',';
+                        }
+                        lo = round_start[k];
+                    }
+                    hi = round_start[k] + n - 1;
+                    round_start[k] += n;
+                }
+                rank_range_output(out, separator, lo, hi);
+                output_putc(out, '\n');
+            }
+        }
+        free(round_start);
+    }
+    nodelist_iter_destroy(&it);
+    task_count_index_destroy(&tci);
+    return 0;
+}
+
+//
+
+/*
+ * Hosts for the next split group when groups are measured in tasks:  the
+ * hosts are taken while their tasks fit within <target>; with <nearest>
+ * the group ends on whichever host boundary is nearer the target.  A
+ * group always gets at least one host.  Runs of equal counts are taken in
+ * one step.
+ */
+size_t
+split_task_hosts(
+    task_count_t    *tc,
+    size_t          hosts_left,
+    long            target,
+    bool            nearest,
+    long            *weight
+)
+{
+    size_t          hosts = 0;
+    long            w = 0;
+
+    while ( hosts < hosts_left ) {
+        size_t      c, k;
+        long        v;
+
+        if ( tc->count == 0 ) {
+            if ( task_count_next(tc) < 0 ) break;
+            tc->count++;
+        }
+        v = tc->value;
+        c = ((size_t)tc->count < hosts_left - hosts) ? (size_t)tc->count : (hosts_left - hosts);
+        k = v ? ((target > w) ? (size_t)((target - w) / v) : 0) : c;
+        if ( k > c ) k = c;
+        hosts += k;
+        w += (long)k * v;
+        tc->count -= k;
+        if ( k < c ) {
+            /* The next host would pass the target: */
+            if ( (hosts == 0) || (nearest && (w + v - target < target - w)) ) {
+                hosts++;
+                w += v;
+                tc->count--;
+            }
+            break;
+        }
+    }
+    *weight += w;
+    return hosts;
+}
+
+/*
+ * Output the list in consecutive groups, one per line in the form of the
+ * mode.  Each group is a piece of the list's range table, so only the
+ * ranges at group boundaries are cut and no host is expanded.  No group
+ * is ever empty:  a list of fewer than N hosts is split into fewer groups.
+ */
+int
+print_split(
+    output_t                    *out,
+    const snodelist_options_t   *opts,
+    const nodelist_t            *nodes
+)
+{
+    nodelist_split_t            split;
+    task_count_t                tc;
+    size_t                      n = nodelist_count(nodes), done = 0, g;
+    size_t                      groups = (opts->split_count < n) ? opts->split_count : n;
+    long                        total = 0, weight = 0;
+    const char                  *delimiter = opts->delimiter;
+
+    /* Each group must stay on one line: */
+    if ( strchr(delimiter, '\n') ) delimiter = ",";
+
+    if ( opts->split_task_counts ) {
+        task_count_init(&tc, opts->split_task_counts);
+        if ( ! task_count_sum(&tc, n, &total) ) {
+            fprintf(stderr, "ERROR:  task counts do not cover %lu hosts: %s\n", (unsigned long)n, opts->split_task_counts);
+            return EINVAL;
+        }
+        task_count_init(&tc, opts->split_task_counts);
+    }
+
+    nodelist_split_init(&split, nodes);
+    for ( g = 0; opts->split_count ? (g < groups) : (done < n); g++ ) {
+        const nodelist_t        *piece;
+        size_t                  hosts;
+
+        if ( ! opts->split_task_counts ) {
+            hosts = opts->split_count ? (n / groups + (g < n % groups)) : opts->split_size;
+        } else if ( ! opts->split_count ) {
+            hosts = split_task_hosts(&tc, n - done, opts->split_size, false, &weight);
+        } else if ( g + 1 == groups ) {
+            hosts = n - done;
+        } else {
+            /* Group g ends nearest to an equal share of the tasks left, and
+             * leaves at least one host for each group after it:
+             */
+            size_t              groups_left = groups - g;
+
+            hosts = split_task_hosts(&tc, n - done - (groups_left - 1), (total - weight) / groups_left, true, &weight);
+        }
+        piece = nodelist_split_next(&split, hosts);
+        done += nodelist_count(piece);
+        if ( opts->mode == snodelist_mode_expand ) {
+            nodelist_expand(piece, delimiter, strlen(delimiter), out);
+        } else {
+            char                *outList = nodelist_ranged_string(piece);
+
+            output_puts(out, outList);
+            free(outList);
+        }
+        output_putc(out, '\n');
+    }
+    nodelist_split_destroy(&split);
+    return 0;
+}
+
+//
+
+/*
+ * Tree mode.  Host 0 is the root and its span is the whole list; a host
+ * sends to the rest of its span by cutting it into <width> consecutive
+ * parts of (nearly) equal size, each of whose first host is a child whose
+ * span is that part.  A host's place in the tree is found by descending
+ * from the root, one division per level, so a lookup costs O(log n) and
+ * never walks the hosts.
+ *
+ * For --tree-host the host itself is first found with nodelist_position(),
+ * one pass over the range table:  that is the order of parsing the list,
+ * which each run does anyway, and a per-prefix search index would cost
+ * O(ranges log ranges) to build for the single lookup it serves.
+ *
+ * Sets <parent> (SIZE_MAX for the root) and <span_end>, the end of the
+ * span that starts at <position>.
+ */
+void
+tree_locate(
+    size_t          n,
+    size_t          width,
+    size_t          position,
+    size_t          *parent,
+    size_t          *span_end
+)
+{
+    size_t          lo = 0, hi = n;
+
+    *parent = SIZE_MAX;
+    while ( lo != position ) {
+        size_t      base = lo + 1, m = hi - base, q = m / width, r = m % width;
+        size_t      offset = position - base, big = r * (q + 1);
+
+        *parent = lo;
+        if ( offset < big ) {
+            lo = base + (offset / (q + 1)) * (q + 1);
+            hi = lo + q + 1;
+        } else {
+            lo = base + big + ((offset - big) / q) * q;
+            hi = lo + q;
+        }
+    }
+    *span_end = hi;
+}
+
+/*
+ * Append the children of the host at <position> to <children>.
+ */
+void
+tree_children(
+    const nodelist_locator_t    *loc,
+    nodelist_t                  *children,
+    size_t                      width,
+    size_t                      position,
+    size_t                      span_end
+)
+{
+    size_t                      base = position + 1, m = span_end - base, q = m / width, r = m % width, g;
+
+    if ( m <= width ) {
+        nodelist_locator_append(loc, children, base, span_end);
+        return;
+    }
+    for ( g = 0; g < width; g++ ) {
+        size_t                  child = base + g * q + ((g < r) ? g : r);
+
+        nodelist_locator_append(loc, children, child, child + 1);
+    }
+}
+
+void
+print_tree_host(
+    output_t                    *out,
+    const nodelist_locator_t    *loc,
+    size_t                      width,
+    size_t                      position,
+    char                        *buffer
+)
+{
+    nodelist_t                  *children = nodelist_create();
+    size_t                      parent, span_end;
+
+    tree_locate(nodelist_count(loc->nl), width, position, &parent, &span_end);
+    output_write(out, buffer, nodelist_locator_render(loc, position, buffer));
+    output_putc(out, ' ');
+    if ( parent == SIZE_MAX ) output_putc(out, '-');
+    else output_write(out, buffer, nodelist_locator_render(loc, parent, buffer));
+    output_putc(out, ' ');
+    tree_children(loc, children, width, position, span_end);
+    if ( nodelist_count(children) ) {
+        char                    *outList = nodelist_ranged_string(children);
+
+        output_puts(out, outList);
+        free(outList);
+    } else {
+        output_putc(out, '-');
+    }
+    output_putc(out, '\n');
+    nodelist_destroy(children);
+}
+
+int
+print_tree(
+    output_t                    *out,
+    const snodelist_options_t   *opts,
+    const nodelist_t            *nodes
+)
+{
+    nodelist_locator_t          loc;
+    size_t                      width = opts->tree_width ? opts->tree_width : SNODELIST_TREE_WIDTH_DEFAULT;
+    size_t                      position;
+    char                        *buffer;
+
+    if ( opts->tree_host ) {
+        char                    hostname[HOST_NAME_MAX + 1];
+        const char              *host = snodelist_index_host(opts, hostname), *dot;
+        bool                    found;
+
+        if ( ! host ) return EINVAL;
+        found = nodelist_position(nodes, host, strlen(host), &position);
+        if ( ! found && (dot = strchr(host, '.')) && (dot > host) ) found = nodelist_position(nodes, host, dot - host, &position);
+        if ( ! found ) {
+            fprintf(stderr, "ERROR:  %s is not in the node list\n", host);
+            return ENOENT;
+        }
+    }
+    nodelist_locator_init(&loc, nodes);
+    buffer = malloc(nodelist_host_len_max(nodes) + 1);
+    if ( ! buffer ) {
+        fprintf(stderr, "FATAL:  unable to allocate memory for tree\n");
+        exit(ENOMEM);
+    }
+    if ( opts->tree_host ) {
+        print_tree_host(out, &loc, width, position, buffer);
+    } else {
+        for ( position = 0; position < nodelist_count(nodes); position++ ) print_tree_host(out, &loc, width, position, buffer);
+    }
+    free(buffer);
+    nodelist_locator_destroy(&loc);
+    return 0;
+}
+
+//
+
+/*
+ * Tasks mode.  Only compress looks at individual counts (and those are
+ * run-length encoded as they arrive); expand writes whole runs at once,
+ * and validate compares the host count of the runs with the host count
+ * of the node list's ranges.
+ */
+int
+print_tasks(
+    output_t                    *out,
+    const snodelist_options_t   *opts
+)
+{
+    int                         rc = 0;
+
+    switch ( opts->tasks_op ) {
+
+        case snodelist_tasks_expand: {
+            task_count_index_t  tci;
+            size_t              delimiter_len = strlen(opts->delimiter), i;
+            char                *item;
+
+            if ( ! task_count_index_init(&tci, opts->task_count_list) ) return EINVAL;
+            item = malloc(delimiter_len + 24);
+            if ( ! item ) {
+                fprintf(stderr, "FATAL:  unable to allocate memory for task counts\n");
+                exit(ENOMEM);
+            }
+            for ( i = 0; i < tci.run_count; i++ ) {
+                /* Every count after the first is written as delimiter + count: */
+                size_t          item_len = delimiter_len + snprintf(item + delimiter_len, 24, "%ld", tci.run[i].value);
+
+                memcpy(item, opts->delimiter, delimiter_len);
+                if ( i == 0 ) {
+                    output_write(out, item + delimiter_len, item_len - delimiter_len);
+                    output_repeat(out, item, item_len, tci.run[i].count - 1);
+                } else {
+                    output_repeat(out, item, item_len, tci.run[i].count);
+                }
+            }
+            output_putc(out, '\n');
+            free(item);
+            task_count_index_destroy(&tci);
+            break;
+        }
+
+        case snodelist_tasks_compress: {
+            output_t            *buffer = output_create_buffer();
+            task_count_writer_t w;
+
+            w.out = buffer;
+            w.value = w.count = 0;
+            w.started = false;
+            w.ok = true;
+
+            if ( ! add_from_sources(task_count_writer_add, &w, &opts->includes) || ! w.ok ) {
+                rc = EINVAL;
+            } else {
+                task_count_writer_flush(&w);
+                output_append(out, buffer);
+                output_putc(out, '\n');
+            }
+            output_destroy(buffer);
+            break;
+        }
+
+        case snodelist_tasks_validate: {
+            task_count_index_t  tci;
+            nodelist_t          *nodes;
+
+            if ( ! task_count_index_init(&tci, opts->task_count_list) ) return EINVAL;
+            nodes = nodelist_create();
+            nodelist_push(nodes, opts->node_list);
+            if ( (size_t)tci.host_count != nodelist_count(nodes) ) {
+                fprintf(stderr, "ERROR:  task counts cover %ld hosts but the node list has %lu\n",
+                                tci.host_count, (unsigned long)nodelist_count(nodes));
+                rc = EINVAL;
+            }
+            nodelist_destroy(nodes);
+            task_count_index_destroy(&tci);
+            break;
+        }
+
+    }
+    return rc;
+}
+
+//
+
+static bool
+nodelist_find_host(
+    void            *context,
+    const char      *host,
+    size_t          host_len,
+    size_t          *position
+)
+{
+    return nodelist_position((const nodelist_t*)context, host, host_len, position);
+}
+
+//
+
+int
+snodelist_run_native(
+    const snodelist_options_t   *opts,
+    output_t                    *out
+)
+{
+    nodelist_t                  *nodes = nodelist_create();
+    nodelist_t                  *nodes_exclude = nodelist_create();
+    nodelist_index_t            *exclusion_index;
+    int                         rc = 0;
+
+    if ( ! add_from_sources_threaded(nodes_exclude, &opts->excludes, opts->threads) ) {
+        nodelist_destroy(nodes_exclude);
+        nodelist_destroy(nodes);
+        return EINVAL;
+    }
+    exclusion_index = nodelist_index_create(nodes_exclude);
+
+    if ( opts->mode == snodelist_mode_rank ) {
+        nodelist_push(nodes, opts->node_list);
+        rc = print_rank_query(out, opts, nodes);
+    } else if ( opts->mode == snodelist_mode_distribution ) {
+        nodelist_push(nodes, opts->node_list);
+        rc = print_distribution(out, opts, nodes);
+    } else if ( opts->mode == snodelist_mode_tasks ) {
+        rc = print_tasks(out, opts);
+    } else if ( opts->mode == snodelist_mode_hostfile ) {
+        rc = print_hostfile(out, opts, exclusion_index);
+    } else if ( opts->mode == snodelist_mode_machinefile ) {
+        task_count_t      tc;
+
+        task_count_init(&tc, opts->task_count_list);
+
+        nodelist_push(nodes, opts->node_list);
+        if ( nodelist_count(nodes) > 0 ) {
+            if ( ! print_machinefile_nodelist(out, nodes, exclusion_index, &tc, opts->machinefile_format, opts->no_repeats) ) rc = EINVAL;
+        }
+    } else if ( ! (opts->set_op ? add_from_operands(nodes, opts) :
+                    add_from_sources_threaded(nodes, &opts->includes, opts->threads)) ) {
+        rc = EINVAL;
+    } else {
+        if ( nodelist_count(nodes) > 0 ) {
+            if ( opts->do_uniq && ! opts->set_op ) {
+                if ( opts->uniq_stable ) nodelist_uniq_stable(nodes);
+                else nodelist_uniq(nodes);
+            }
+            nodelist_exclude(nodes, exclusion_index);
+            nodelist_sort(nodes, opts->sort_order, opts->threads);
+            if ( opts->select.active ) {
+                size_t      start, end;
+
+                if ( ! snodelist_select_resolve(&opts->select, nodelist_count(nodes), &start, &end) ) rc = EINVAL;
+                nodelist_slice(nodes, start, end);
+            }
+            if ( rc ) {
+                /* The selected host is not in the list */
+            } else if ( opts->split_count || opts->split_size ) {
+                rc = print_split(out, opts, nodes);
+            } else if ( opts->select.active && (nodelist_count(nodes) == 0) &&
+                        ((opts->mode == snodelist_mode_expand) || (opts->mode == snodelist_mode_compress)) ) {
+                /* An empty selection prints nothing */
+            } else switch ( opts->mode ) {
+
+                case snodelist_mode_expand:
+                    if ( opts->expand_format ) {
+                        expand_format_t     ef;
+
+                        if ( ! expand_format_compile(&ef, opts->expand_format) ) {
+                            rc = EINVAL;
+                            break;
+                        }
+                        rc = expand_format_write(&ef, nodes, opts->delimiter, out);
+                        expand_format_destroy(&ef);
+                        if ( rc ) break;
+                    } else {
+                        nodelist_expand_threaded(nodes, opts->delimiter, strlen(opts->delimiter), out, opts->threads);
+                    }
+                    output_putc(out, '\n');
+                    break;
+
+                case snodelist_mode_compress: {
+                    char            *outList = nodelist_ranged_string(nodes);
+
+                    output_puts(out, outList);
+                    output_putc(out, '\n');
+                    free(outList);
+                    break;
+                }
+
+                case snodelist_mode_count:
+                    output_int(out, nodelist_count(nodes));
+                    output_putc(out, '\n');
+                    break;
+
+                case snodelist_mode_index:
+                    rc = print_index_of(out, opts, nodelist_find_host, nodes);
+                    break;
+
+                case snodelist_mode_tree:
+                    rc = print_tree(out, opts, nodes);
+                    break;
+
+                default:
+                    break;
+
+            }
+        } else if ( opts->select.exact ) {
+            size_t      start, end;
+
+            if ( ! snodelist_select_resolve(&opts->select, 0, &start, &end) ) rc = EINVAL;
+        } else if ( opts->split_count || opts->split_size ) {
+            rc = print_split(out, opts, nodes);
+        } else if ( opts->mode == snodelist_mode_count ) {
+            output_puts(out, "0\n");
+        } else if ( opts->mode == snodelist_mode_index ) {
+            rc = print_index_of(out, opts, nodelist_find_host, nodes);
+        } else if ( opts->mode == snodelist_mode_tree ) {
+            rc = print_tree(out, opts, nodes);
+        }
+    }
+    nodelist_index_destroy(exclusion_index);
+    nodelist_destroy(nodes_exclude);
+    nodelist_destroy(nodes);
+
+    return rc;
+}
+
+//
+
+/*
+ * The feature of the command that only the native engine implements, or
+ * NULL if either backend can run it.
+ */
+static const char*
+snodelist_native_only_feature(
+    const snodelist_options_t   *opts
+)
+{
+    if ( opts->set_op ) return "set operators";
+    switch ( opts->mode ) {
+        case snodelist_mode_rank:           return "rank mode";
+        case snodelist_mode_distribution:   return "--distribution";
+        case snodelist_mode_tasks:          return "--tasks";
+        case snodelist_mode_hostfile:       return "--from-hostfile";
+        case snodelist_mode_tree:           return "--tree";
+        default:                            break;
+    }
+    if ( opts->split_count || opts->split_size ) return "--split";
+    if ( opts->do_uniq && opts->uniq_stable ) return "--unique=stable";
+    if ( opts->sort_order ) return "--sort";
+    if ( opts->expand_format ) return "-F/--expand-format";
+    return NULL;
+}
+
+int
+snodelist_run(
+    const snodelist_options_t   *opts,
+    output_t                    *out
+)
+{
+    const char                  *native_only = snodelist_native_only_feature(opts);
+
+    /* Set operators, the job layout modes and the newer list options are
+     * only implemented by the native engine:
+     */
+    if ( native_only && (opts->backend == snodelist_backend_slurm) ) {
+        fprintf(stderr, "WARNING:  the native backend is used instead of slurm for %s\n", native_only);
+    }
+    switch ( native_only ? snodelist_backend_native : opts->backend ) {
+
+        case snodelist_backend_slurm:
+            return snodelist_run_slurm(opts, out);
+
+        case snodelist_backend_native:
+        default:
+            return snodelist_run_native(opts, out);
+
+    }
+}
+
+//
+
+/*
+ * Parse a host position; the whole string must be an integer.
+ */
+static bool
+snodelist_select_position(
+    const char      *s,
+    const char      *s_end,
+    long            *position
+)
+{
+    char            *end;
+
+    if ( s == s_end ) return false;
+    errno = 0;
+    *position = strtol(s, &end, 10);
+    return ( (errno == 0) && (end == s_end) );
+}
+
+/*
+ * Fill in <select> from the argument of --head, --tail, --slice or --nth
+ * (given by <optc>).
+ */
+bool
+snodelist_select_parse(
+    snodelist_select_t  *select,
+    int                 optc,
+    const char          *optarg
+)
+{
+    const char          *optarg_end = optarg + strlen(optarg), *colon;
+    long                n;
+
+    select->active = true;
+    select->exact = (optc == snodelist_opt_nth);
+    select->start = 0;
+    select->end = 0;
+    select->has_end = true;
+    switch ( optc ) {
+
+        case snodelist_opt_head:
+            if ( ! snodelist_select_position(optarg, optarg_end, &n) || (n < 0) ) break;
+            select->end = n;
+            return true;
+
+        case snodelist_opt_tail:
+            if ( ! snodelist_select_position(optarg, optarg_end, &n) || (n < 0) ) break;
+            if ( n > 0 ) {
+                select->start = -n;
+                select->has_end = false;
+            }
+            return true;
+
+        case snodelist_opt_nth:
+            if ( ! snodelist_select_position(optarg, optarg_end, &n) || (n == LONG_MAX) ) break;
+            select->start = n;
+            select->end = n + 1;
+            select->has_end = (n != -1);
+            return true;
+
+        case snodelist_opt_slice:
+            if ( ! (colon = strchr(optarg, ':')) ) break;
+            if ( (colon > optarg) && ! snodelist_select_position(optarg, colon, &select->start) ) break;
+            if ( colon + 1 == optarg_end ) {
+                select->has_end = false;
+            } else if ( ! snodelist_select_position(colon + 1, optarg_end, &select->end) ) {
+                break;
+            }
+            return true;
+
+    }
+    fprintf(stderr, "ERROR:  invalid host selection: %s\n", optarg);
+    return false;
+}
+
+//
+
+/*
+ * Apply the arguments in <argv> to <opts>, which holds the defaults.  A
+ * batch query is parsed just like a command line, except that -h, --batch
+ * and reading stdin are not accepted, and a machinefile query names its
+ * node list, task counts and (optionally) line format as arguments rather
+ * than through the environment.  Returns zero or an errno value.
+ */
+int
+snodelist_options_parse(
+    snodelist_options_t   *opts,
+    int                   argc,
+    char * const          argv[],
+    bool                  is_query
+)
+{
+    int                   optc;
+    bool                  did_include_an_env_var = false;
+
+    optind = 0;
+    while ( (optc = getopt_long(argc, argv, snodelist_opts_string, snodelist_opts, NULL)) != -1 ) {
+        switch ( optc ) {
+
+            case 'h':
+                if ( is_query ) {
+                    fprintf(stderr, "ERROR:  -h/--help cannot be used in a batch query\n");
+                    return EINVAL;
+                }
+                usage(argv[0]);
+                exit(0);
+
+            case 'e':
+                opts->mode = snodelist_mode_expand;
+                break;
+
+            case 'c':
+                opts->mode = snodelist_mode_compress;
+                break;
+
+            case 'i': {
+                const char    *env_var_name;
+
+         if ( optc == ':' ) {
+                    env_var_name = "SLURM_JOB_NODELIST";
+                } else if ( optarg && *optarg ) {
+                    env_var_name = optarg;
+                } else {
+                    fprintf(stderr, "ERROR:  invalid variable name provided with -i/--include-env option\n");
+                    return EINVAL;
+                }
+                snodelist_sources_push(&opts->includes, snodelist_source_env, env_var_name);
+                did_include_an_env_var = true;
+                break;
+            }
+
+            case 'l':
+                if ( optarg && *optarg ) {
+                    if ( is_query && (strcmp(optarg, "-") == 0) ) {
+                        fprintf(stderr, "ERROR:  a batch query cannot read a nodelist from stdin\n");
+                        return EINVAL;
+                    }
+                    snodelist_sources_push(&opts->includes, snodelist_source_file, optarg);
+                    did_include_an_env_var = true;
+                } else {
+                    fprintf(stderr, "ERROR:  invalid file path provided with -f/--nodelist option\n");
+                    return EINVAL;
+                }
+                break;
+
+            case 'X':
+                if ( optarg && *optarg ) {
+                    snodelist_sources_push(&opts->excludes, snodelist_source_env, optarg);
+                } else {
+                    fprintf(stderr, "ERROR:  no variable name provided with -X/--exclude-env option\n");
+                    return EINVAL;
+                }
+                break;
+
+            case 'x':
+                if ( optarg && *optarg ) {
+                    snodelist_sources_push(&opts->excludes, snodelist_source_expression, optarg);
+                } else {
+                    fprintf(stderr, "ERROR:  no host list provided with -x/--exclude option\n");
+                    return EINVAL;
+                }
+                break;
+
+            case 'u':
+                opts->do_uniq = true;
+                opts->uniq_stable = false;
+                break;
+
+            case snodelist_opt_unique:
+                if ( optarg && strcmp(optarg, "stable") && strcmp(optarg, "sorted") ) {
+                    fprintf(stderr, "ERROR:  invalid --unique variant: %s\n", optarg);
+                    return EINVAL;
+                }
+                opts->do_uniq = true;
+                opts->uniq_stable = optarg && (strcmp(optarg, "stable") == 0);
+                break;
+
+            case 'd':
+                if ( ! optarg ) {
+                    fprintf(stderr, "ERROR:  no delimiter string provided with -d/--delimiter option\n");
+                    return EINVAL;
+                }
+                opts->delimiter = optarg;
+                break;
+
+            case 'F':
+                if ( ! optarg || ! *optarg ) {
+                    fprintf(stderr, "ERROR:  no format provided with -F/--expand-format option\n");
+                    return EINVAL;
+                }
+                opts->expand_format = optarg;
+                break;
+
+            case 'm':
+                opts->mode = snodelist_mode_machinefile;
+                break;
+
+            case 'f':
+                opts->machinefile_format = optarg;
+                break;
+
+            case 'n':
+                opts->no_repeats = true;
+                break;
+
+            case 'B':
+                if ( ! snodelist_backend_from_string(optarg, &opts->backend) ) return EINVAL;
+                break;
+
+            case 'T': {
+                char          *end;
+                long          n = strtol(optarg, &end, 10);
+
+                if ( (end == optarg) || *end || (n < 1) || (n > 4096) ) {
+                    fprintf(stderr, "ERROR:  invalid thread count: %s\n", optarg);
+                    return EINVAL;
+                }
+                opts->threads = n;
+                break;
+            }
+
+            case snodelist_opt_batch:
+                if ( is_query ) {
+                    fprintf(stderr, "ERROR:  --batch cannot be used in a batch query\n");
+                    return EINVAL;
+                }
+                opts->batch = true;
+                break;
+
+            case snodelist_opt_serve:
+                if ( is_query ) {
+                    fprintf(stderr, "ERROR:  --serve cannot be used in a batch query\n");
+                    return EINVAL;
+                }
+                if ( ! optarg || ! *optarg ) {
+                    fprintf(stderr, "ERROR:  no socket path provided with --serve option\n");
+                    return EINVAL;
+                }
+                opts->serve_socket = optarg;
+                break;
+
+            case snodelist_opt_job_cache:
+                if ( is_query ) {
+                    fprintf(stderr, "ERROR:  --job-cache cannot be used in a batch query\n");
+                    return EINVAL;
+                }
+                opts->job_cache_dir = (optarg && *optarg) ? optarg : snodelist_default_job_cache_dir;
+                break;
+
+            case snodelist_opt_job_cache_clean:
+                if ( is_query ) {
+                    fprintf(stderr, "ERROR:  --job-cache-clean cannot be used in a batch query\n");
+                    return EINVAL;
+                }
+                opts->job_cache_clean_dir = (optarg && *optarg) ? optarg : snodelist_default_job_cache_dir;
+                break;
+
+            case snodelist_opt_union:
+                opts->set_op = nodelist_set_union;
+                break;
+
+            case snodelist_opt_intersect:
+                opts->set_op = nodelist_set_intersect;
+                break;
+
+            case snodelist_opt_minus:
+                opts->set_op = nodelist_set_minus;
+                break;
+
+            case snodelist_opt_xor:
+                opts->set_op = nodelist_set_xor;
+                break;
+
+            case snodelist_opt_count:
+                opts->mode = snodelist_mode_count;
+                break;
+
+            case snodelist_opt_index_of:
+            case snodelist_opt_whoami:
+                opts->mode = snodelist_mode_index;
+                opts->index_host = (optarg && *optarg) ? optarg : NULL;
+                break;
+
+            case snodelist_opt_first_rank:
+                if ( optarg && *optarg ) {
+                    opts->first_rank_counts = optarg;
+                } else if ( is_query ) {
+                    fprintf(stderr, "ERROR:  --first-rank needs task counts in a batch query\n");
+                    return EINVAL;
+                } else if ( ! (opts->first_rank_counts = getenv("SLURM_TASKS_PER_NODE")) || ! *opts->first_rank_counts ) {
+                    fprintf(stderr, "ERROR:  no SLURM_TASKS_PER_NODE in environment\n");
+                    return EINVAL;
+                }
+                break;
+
+            case snodelist_opt_rank_host:
+            case snodelist_opt_local_rank: {
+                char          *end;
+
+                opts->mode = snodelist_mode_rank;
+                opts->rank_query = (optc == snodelist_opt_rank_host) ? snodelist_rank_query_host : snodelist_rank_query_local;
+                errno = 0;
+                opts->rank = strtol(optarg, &end, 10);
+                if ( (end == optarg) || *end || errno || (opts->rank < 0) ) {
+                    fprintf(stderr, "ERROR:  invalid task rank: %s\n", optarg);
+                    return EINVAL;
+                }
+                break;
+            }
+
+            case snodelist_opt_host_ranks:
+                if ( ! optarg || ! *optarg ) {
+                    fprintf(stderr, "ERROR:  no host name provided with --host-ranks option\n");
+                    return EINVAL;
+                }
+                opts->mode = snodelist_mode_rank;
+                opts->rank_query = snodelist_rank_query_ranks;
+                opts->rank_host = optarg;
+                break;
+
+            case snodelist_opt_split:
+            case snodelist_opt_split_size: {
+                char          *end;
+                long          n;
+
+                errno = 0;
+                n = strtol(optarg, &end, 10);
+                if ( (end == optarg) || *end || errno || (n <= 0) ) {
+                    fprintf(stderr, "ERROR:  invalid group %s: %s\n", (optc == snodelist_opt_split) ? "count" : "size", optarg);
+                    return EINVAL;
+                }
+                opts->split_count = (optc == snodelist_opt_split) ? n : 0;
+                opts->split_size = (optc == snodelist_opt_split) ? 0 : n;
+                break;
+            }
+
+            case snodelist_opt_tree: {
+                char          *end;
+                long          n;
+
+                errno = 0;
+                n = strtol(optarg, &end, 10);
+                if ( (end == optarg) || *end || errno || (n <= 0) ) {
+                    fprintf(stderr, "ERROR:  invalid tree width: %s\n", optarg);
+                    return EINVAL;
+                }
+                opts->mode = snodelist_mode_tree;
+                opts->tree_width = n;
+                break;
+            }
+
+            case snodelist_opt_tree_host:
+                opts->mode = snodelist_mode_tree;
+                opts->tree_host = true;
+                opts->index_host = (optarg && *optarg) ? optarg : NULL;
+                break;
+
+            case snodelist_opt_split_tasks:
+                if ( optarg && *optarg ) {
+                    opts->split_task_counts = optarg;
+                } else if ( is_query ) {
+                    fprintf(stderr, "ERROR:  --split-tasks needs task counts in a batch query\n");
+                    return EINVAL;
+                } else if ( ! (opts->split_task_counts = getenv("SLURM_TASKS_PER_NODE")) || ! *opts->split_task_counts ) {
+                    fprintf(stderr, "ERROR:  no SLURM_TASKS_PER_NODE in environment\n");
+                    return EINVAL;
+                }
+                break;
+
+            case snodelist_opt_distribution:
+                if ( ! distribution_from_string(optarg, &opts->distribution_plane) ) return EINVAL;
+                opts->mode = snodelist_mode_distribution;
+                break;
+
+            case snodelist_opt_rankfile:
+                opts->mode = snodelist_mode_distribution;
+                opts->rankfile = true;
+                break;
+
+            case snodelist_opt_tasks: {
+                int           op = 0;
+
+                while ( snodelist_tasks_op_strings[op] && strcmp(optarg, snodelist_tasks_op_strings[op]) ) op++;
+                if ( ! snodelist_tasks_op_strings[op] ) {
+                    fprintf(stderr, "ERROR:  unknown --tasks operation: %s\n", optarg);
+                    return EINVAL;
+                }
+                opts->mode = snodelist_mode_tasks;
+                opts->tasks_op = (snodelist_tasks_op)op;
+                break;
+            }
+
+            case snodelist_opt_from_hostfile:
+                opts->mode = snodelist_mode_hostfile;
+                break;
+
+            case snodelist_opt_sort: {
+                int           order = 0;
+
+                while ( snodelist_sort_order_strings[order] && strcmp(optarg, snodelist_sort_order_strings[order]) ) order++;
+                if ( ! snodelist_sort_order_strings[order] ) {
+                    fprintf(stderr, "ERROR:  unknown sort order: %s\n", optarg);
+                    return EINVAL;
+                }
+                opts->sort_order = (nodelist_sort_order)order;
+                break;
+            }
+
+            case snodelist_opt_head:
+            case snodelist_opt_tail:
+            case snodelist_opt_slice:
+            case snodelist_opt_nth:
+                if ( ! snodelist_select_parse(&opts->select, optc, optarg) ) return EINVAL;
+                break;
+
+        }
+    }
+
+    if ( (opts->split_count || opts->split_size) && (opts->mode != snodelist_mode_expand) &&
+                (opts->mode != snodelist_mode_compress) ) {
+        fprintf(stderr, "ERROR:  --split and --split-size can only be used in expand and compress modes\n");
+        return EINVAL;
+    }
+    if ( opts->expand_format && ((opts->mode != snodelist_mode_expand) || opts->split_count || opts->split_size) ) {
+        fprintf(stderr, "ERROR:  -F/--expand-format can only be used in expand mode without --split\n");
+        return EINVAL;
+    }
+    if ( opts->split_task_counts && ! opts->split_count && ! opts->split_size ) {
+        fprintf(stderr, "ERROR:  --split-tasks needs --split or --split-size\n");
+        return EINVAL;
+    }
+
+    if ( opts->batch || opts->serve_socket ) {
+        if ( optind < argc ) {
+            fprintf(stderr, "ERROR:  host expressions cannot be given with --batch or --serve\n");
+            return EINVAL;
+        }
+        /* The queries themselves arrive on stdin: */
+        for ( unsigned i = 0; i < opts->includes.count; i++ ) {
+            if ( (opts->includes.list[i].type == snodelist_source_file) && (strcmp(opts->includes.list[i].value, "-") == 0) ) {
+                fprintf(stderr, "ERROR:  a nodelist cannot be read from stdin with --batch or --serve\n");
+                return EINVAL;
+            }
+        }
+    } else if ( (opts->mode == snodelist_mode_machinefile) || (opts->mode == snodelist_mode_rank) ||
+                (opts->mode == snodelist_mode_distribution) ) {
+        const char  *mode_name = snodelist_mode_strings[opts->mode];
+
+        if ( opts->set_op ) {
+            fprintf(stderr, "ERROR:  --%s cannot be used in %s mode\n", snodelist_set_op_strings[opts->set_op], mode_name);
+            return EINVAL;
+        }
+        if ( opts->select.active ) {
+            fprintf(stderr, "ERROR:  host selections cannot be used in %s mode\n", mode_name);
+            return EINVAL;
+        }
+        if ( (opts->mode != snodelist_mode_machinefile) && opts->excludes.count ) {
+            fprintf(stderr, "ERROR:  hosts cannot be excluded in %s mode\n", mode_name);
+            return EINVAL;
+        }
+        if ( is_query ) {
+            if ( opts->mode != snodelist_mode_machinefile ) {
+                if ( argc - optind != 2 ) {
+                    fprintf(stderr, "ERROR:  a %s query takes <node list> <task counts>\n", mode_name);
+                    return EINVAL;
+                }
+            } else if ( (argc - optind < 2) || (argc - optind > 3) ) {
+                fprintf(stderr, "ERROR:  a machinefile query takes <node list> <task counts> {<line-format>}\n");
+                return EINVAL;
+            }
+            opts->node_list = argv[optind++];
+            opts->task_count_list = argv[optind++];
+            if ( optind < argc ) opts->machinefile_format = argv[optind];
+        } else {
+            opts->node_list = getenv("SLURM_JOB_NODELIST");
+            opts->task_count_list = getenv("SLURM_TASKS_PER_NODE");
+        }
+        if ( ! opts->node_list || ! *opts->node_list ) {
+            fprintf(stderr, "ERROR:  no SLURM_JOB_NODELIST in environment\n");
+            return EINVAL;
+        }
+        if ( ! opts->task_count_list || ! *opts->task_count_list ) {
+            fprintf(stderr, "ERROR:  no SLURM_TASKS_PER_NODE in environment\n");
+            return EINVAL;
+        }
+    } else if ( opts->mode == snodelist_mode_hostfile ) {
+        if ( opts->set_op || opts->select.active ) {
+            fprintf(stderr, "ERROR:  set operators and host selections cannot be used with --from-hostfile\n");
+            return EINVAL;
+        }
+        if ( optind < argc ) {
+            fprintf(stderr, "ERROR:  host files are read with -l/--nodelist or from stdin\n");
+            return EINVAL;
+        }
+        if ( ! did_include_an_env_var ) {
+            if ( is_query ) {
+                fprintf(stderr, "ERROR:  a from-hostfile query needs -l/--nodelist\n");
+                return EINVAL;
+            }
+            snodelist_sources_push(&opts->includes, snodelist_source_file, "-");
+        }
+        for ( unsigned i = 0; i < opts->includes.count; i++ ) {
+            if ( opts->includes.list[i].type != snodelist_source_file ) {
+                fprintf(stderr, "ERROR:  host files are read with -l/--nodelist or from stdin\n");
+                return EINVAL;
+            }
+        }
+    } else if ( opts->mode == snodelist_mode_tasks ) {
+        if ( opts->set_op || opts->select.active || opts->excludes.count ) {
+            fprintf(stderr, "ERROR:  set operators, host selections and exclusions cannot be used in tasks mode\n");
+            return EINVAL;
+        }
+        if ( opts->tasks_op == snodelist_tasks_compress ) {
+            if ( optind == argc && ! did_include_an_env_var ) {
+                if ( is_query ) {
+                    fprintf(stderr, "ERROR:  a tasks query cannot read counts from stdin\n");
+                    return EINVAL;
+                }
+                snodelist_sources_push(&opts->includes, snodelist_source_file, "-");
+            }
+            while ( optind < argc ) {
+                snodelist_sources_push(&opts->includes, snodelist_source_expression, argv[optind]);
+                optind++;
+            }
+        } else {
+            int     arg_max = (opts->tasks_op == snodelist_tasks_validate) ? 2 : 1;
+
+            if ( (argc - optind > arg_max) || (is_query && (argc - optind < arg_max)) ) {
+                fprintf(stderr, "ERROR:  --tasks=%s takes %s arguments\n", snodelist_tasks_op_strings[opts->tasks_op],
+                                (arg_max == 2) ? "<counts> <host expression>" : "<counts>");
+                return EINVAL;
+            }
+            opts->task_count_list = (optind < argc) ? argv[optind++] : getenv("SLURM_TASKS_PER_NODE");
+            if ( arg_max == 2 ) opts->node_list = (optind < argc) ? argv[optind++] : getenv("SLURM_JOB_NODELIST");
+            if ( ! opts->task_count_list || ! *opts->task_count_list ) {
+                fprintf(stderr, "ERROR:  no SLURM_TASKS_PER_NODE in environment\n");
+                return EINVAL;
+            }
+            if ( (arg_max == 2) && (! opts->node_list || ! *opts->node_list) ) {
+                fprintf(stderr, "ERROR:  no SLURM_JOB_NODELIST in environment\n");
+                return EINVAL;
+            }
+        }
+    } else {
+        if ( optind == argc && ! did_include_an_env_var ) {
+            snodelist_sources_push(&opts->includes, snodelist_source_env, "SLURM_JOB_NODELIST");
+        }
+        while ( optind < argc ) {
+            snodelist_sources_push(&opts->includes, snodelist_source_expression, argv[optind]);
+            optind++;
+        }
+    }
+    return 0;
+}
+
+//
+
+/*
+ * Split a batch query into words, in place.  Words are separated by
+ * whitespace and may be quoted with '...' or "..." (inside double quotes
+ * \n is a newline and a backslash escapes any other character).  The words are appended to
+ * <argv> after its first <argc> entries; returns the new count, or -1 if
+ * a quote is left open.
+ */
+int
+snodelist_batch_split(
+    char        *line,
+    char        ***argv,
+    unsigned    *argv_capacity,
+    int         argc
+)
+{
+    char        *p = line, *q;
+
+    while ( true ) {
+        char    quote = '\0';
+
+        while ( *p && isspace((unsigned char)*p) ) p++;
+        if ( ! *p ) break;
+        if ( (unsigned)argc + 2 > *argv_capacity ) {
+            unsigned    new_capacity = 2 * *argv_capacity;
+            char        **new_argv = realloc(*argv, new_capacity * sizeof(char*));
+
+            if ( ! new_argv ) {
+                fprintf(stderr, "FATAL:  unable to allocate memory for batch query\n");
+                exit(ENOMEM);
+            }
+            *argv = new_argv;
+            *argv_capacity = new_capacity;
+        }
+        (*argv)[argc++] = q = p;
+        while ( *p && (quote || ! isspace((unsigned char)*p)) ) {
+            if ( quote ) {
+                if ( *p == quote ) {
+                    quote = '\0';
+                    p++;
+                    continue;
+                }
+                if ( (quote == '"') && (*p == '\\') && *(p + 1) ) {
+                    if ( *(++p) == 'n' ) {
+                        *q++ = '\n';
+                        p++;
+                        continue;
+                    }
+                }
+            } else if ( (*p == '\'') || (*p == '"') ) {
+                quote = *p++;
+                continue;
+            }
+            *q++ = *p++;
+        }
+        if ( quote ) return -1;
+        if ( *p ) p++;
+        *q = '\0';
+    }
+    (*argv)[argc] = NULL;
+    return argc;
+}
+
+/*
+ * Batch mode:  each line read from stdin is a query -- one of the mode
+ * names (expand, compress, machinefile) followed by arguments as they
+ * would appear on the command line, e.g.
+ *
+ *     compress n[000-015] -x n003
+ *     machinefile n[000-003] 4(x2),2(x2) "%h slots=%c"
+ *
+ * Options given with --batch are the defaults for every query.  Each
+ * query is answered with a header line
+ *
+ *     <status> <length>
+ *
+ * followed by <length> bytes of output, where <status> is the exit status
+ * the equivalent command would have returned.  Diagnostics still go to
+ * stderr.  Empty lines are ignored.
+ */
+typedef struct {
+    const snodelist_options_t   *defaults;
+    output_t                    *response;
+    char                        **argv;
+    unsigned                    argv_capacity;
+    int                         argc;
+    bool                        cacheable;      /* the answer depends only on the query's words */
+} snodelist_batch_t;
+
+void
+snodelist_batch_init(
+    snodelist_batch_t           *batch,
+    const snodelist_options_t   *defaults
+)
+{
+    batch->defaults = defaults;
+    batch->response = output_create_buffer();
+    batch->argv_capacity = 16;
+    batch->argv = malloc(batch->argv_capacity * sizeof(char*));
+    if ( ! batch->argv ) {
+        fprintf(stderr, "FATAL:  unable to allocate memory for batch query\n");
+        exit(ENOMEM);
+    }
+    batch->argv[0] = "snodelist";
+    batch->argc = 0;
+    batch->cacheable = false;
+}
+
+void
+snodelist_batch_destroy(
+    snodelist_batch_t   *batch
+)
+{
+    output_destroy(batch->response);
+    free(batch->argv);
+}
+
+/*
+ * Split <line> into the batch's argument words; returns false if the
+ * line is empty.
+ */
+bool
+snodelist_batch_split_line(
+    snodelist_batch_t   *batch,
+    char                *line
+)
+{
+    batch->argc = snodelist_batch_split(line, &batch->argv, &batch->argv_capacity, 1);
+    return (batch->argc != 1);
+}
+
+/*
+ * Answer the query split into the batch's arguments, leaving its output
+ * in batch->response; returns its exit status.
+ */
+int
+snodelist_batch_query(
+    snodelist_batch_t           *batch
+)
+{
+    const snodelist_options_t   *defaults = batch->defaults;
+    snodelist_options_t         opts = *defaults;
+    char                        **argv = batch->argv;
+    int                         rc = EINVAL, mode = 0;
+    unsigned                    i;
+
+    batch->cacheable = false;
+    if ( batch->argc < 0 ) {
+        fprintf(stderr, "ERROR:  unterminated quote in batch query\n");
+        return rc;
+    }
+
+    memset(&opts.includes, 0, sizeof(opts.includes));
+    memset(&opts.excludes, 0, sizeof(opts.excludes));
+    for ( i = 0; i < defaults->includes.count; i++ ) {
+        snodelist_sources_push(&opts.includes, defaults->includes.list[i].type, defaults->includes.list[i].value);
+    }
+    for ( i = 0; i < defaults->excludes.count; i++ ) {
+        snodelist_sources_push(&opts.excludes, defaults->excludes.list[i].type, defaults->excludes.list[i].value);
+    }
+    opts.batch = false;
+    opts.serve_socket = NULL;
+
+    while ( snodelist_mode_strings[mode] && strcmp(argv[1], snodelist_mode_strings[mode]) ) mode++;
+    if ( ! snodelist_mode_strings[mode] ) {
+        fprintf(stderr, "ERROR:  unknown batch query: %s\n", argv[1]);
+    } else {
+        /* The mode name stands in for the program name: */
+        opts.mode = (snodelist_mode)mode;
+        argv[1] = argv[0];
+        rc = snodelist_options_parse(&opts, batch->argc - 1, argv + 1, true);
+        if ( rc == 0 ) {
+            /* Nodelist files can change, so answers that read them are not kept: */
+            batch->cacheable = true;
+            for ( i = 0; i < opts.includes.count; i++ ) {
+                if ( opts.includes.list[i].type == snodelist_source_file ) batch->cacheable = false;
+            }
+            rc = snodelist_run(&opts, batch->response);
+        }
+    }
+    if ( opts.includes.list ) free(opts.includes.list);
+    if ( opts.excludes.list ) free(opts.excludes.list);
+    return rc;
+}
+
+void
+snodelist_batch_header(
+    output_t    *out,
+    int         status,
+    size_t      length
+)
+{
+    output_int(out, status);
+    output_putc(out, ' ');
+    output_int(out, length);
+    output_putc(out, '\n');
+}
+
+int
+snodelist_batch(
+    const snodelist_options_t   *defaults,
+    output_t                    *out
+)
+{
+    snodelist_batch_t           batch;
+    char                        *line = NULL;
+    size_t                      line_len = 0;
+
+    snodelist_batch_init(&batch, defaults);
+
+    /* Replies are flushed one at a time, so gifting (and then replacing)
+     * an output block per reply would cost more than copying it:
+     */
+    out->use_vmsplice = false;
+
+    while ( getline(&line, &line_len, stdin) > 0 ) {
+        int                     rc;
+
+        if ( ! snodelist_batch_split_line(&batch, line) ) continue;
+        rc = snodelist_batch_query(&batch);
+        snodelist_batch_header(out, rc, output_length(batch.response));
+        output_append(out, batch.response);
+        output_clear(batch.response);
+        if ( ! output_flush(out) ) break;
+    }
+    if ( line ) free(line);
+    snodelist_batch_destroy(&batch);
     return 0;
 }
+
+//
+
+/*
+ * Server mode:  batch queries are answered for any number of clients
+ * connected to a Unix domain socket.  Each connection has its own thread,
+ * but queries are answered one at a time under a lock (libslurm and the
+ * ingestion code are not reentrant), and successful answers are kept in
+ * an LRU cache keyed by the words of the query -- so the same query from
+ * many clients is parsed and rendered once.
+ */
+typedef struct {
+    const snodelist_options_t   *defaults;
+    result_cache_t              *cache;
+    pthread_mutex_t             lock;
+} snodelist_server_t;
+
+typedef struct {
+    snodelist_server_t          *server;
+    int                         fd;
+} snodelist_connection_t;
+
+static const char   *snodelist_server_socket_path = NULL;
+
+static void
+snodelist_server_signal(
+    int     signum
+)
+{
+    (void)signum;
+    if ( snodelist_server_socket_path ) unlink(snodelist_server_socket_path);
+    _exit(0);
+}
+
+static void*
+snodelist_server_connection(
+    void                    *context
+)
+{
+    snodelist_connection_t  *connection = (snodelist_connection_t*)context;
+    snodelist_server_t      *server = connection->server;
+    FILE                    *in = fdopen(connection->fd, "r");
+    output_t                *out;
+    snodelist_batch_t       batch;
+    char                    *line = NULL, *key = NULL;
+    size_t                  line_len = 0, key_capacity = 0;
+    ssize_t                 n;
+
+    if ( ! in ) {
+        close(connection->fd);
+        free(connection);
+        return NULL;
+    }
+    out = output_create(connection->fd);
+    snodelist_batch_init(&batch, server->defaults);
+
+    while ( (n = getline(&line, &line_len, in)) > 0 ) {
+        const result_cache_entry_t  *hit = NULL;
+        size_t                      key_len = 0;
+        int                         rc, i;
+
+        if ( ! snodelist_batch_split_line(&batch, line) ) continue;
+
+        /* The key is the query's words, each with its NUL terminator: */
+        if ( key_capacity < (size_t)n + 1 ) {
+            char        *new_key = realloc(key, n + 1);
+
+            if ( ! new_key ) {
+                fprintf(stderr, "FATAL:  unable to allocate memory for batch query\n");
+                exit(ENOMEM);
+            }
+            key = new_key;
+            key_capacity = n + 1;
+        }
+        for ( i = 1; i < batch.argc; i++ ) {
+            size_t      word_len = strlen(batch.argv[i]) + 1;
+
+            memcpy(key + key_len, batch.argv[i], word_len);
+            key_len += word_len;
+        }
+
+        pthread_mutex_lock(&server->lock);
+        if ( key_len ) hit = result_cache_lookup(server->cache, key, key_len);
+        if ( hit ) {
+            rc = hit->status;
+            output_write(batch.response, hit->value, hit->value_len);
+        } else {
+            rc = snodelist_batch_query(&batch);
+            if ( (rc == 0) && batch.cacheable ) {
+                char    *value = result_cache_insert(server->cache, key, key_len, rc, output_length(batch.response));
+
+                if ( value ) output_copy(batch.response, value);
+            }
+        }
+        pthread_mutex_unlock(&server->lock);
+
+        snodelist_batch_header(out, rc, output_length(batch.response));
+        output_append(out, batch.response);
+        output_clear(batch.response);
+        if ( ! output_flush(out) ) break;
+    }
+    if ( line ) free(line);
+    if ( key ) free(key);
+    snodelist_batch_destroy(&batch);
+    output_destroy(out);
+    fclose(in);
+    free(connection);
+    return NULL;
+}
+
+int
+snodelist_serve(
+    const snodelist_options_t   *defaults,
+    const char                  *socket_path
+)
+{
+    snodelist_server_t          server;
+    struct sockaddr_un          addr;
+    struct stat                 finfo;
+    pthread_attr_t              attr;
+    int                         fd, rc;
+
+    if ( strlen(socket_path) >= sizeof(addr.sun_path) ) {
+        fprintf(stderr, "ERROR:  socket path is too long: %s\n", socket_path);
+        return EINVAL;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if ( fd < 0 ) {
+        rc = errno;
+        fprintf(stderr, "ERROR:  unable to create socket: %s\n", strerror(rc));
+        return rc;
+    }
+    if ( bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ) {
+        rc = errno;
+
+        /* A socket left behind by a server that has gone away is replaced: */
+        if ( (rc == EADDRINUSE) && (lstat(socket_path, &finfo) == 0) && S_ISSOCK(finfo.st_mode) ) {
+            int     probe = socket(AF_UNIX, SOCK_STREAM, 0);
+
+            if ( (probe >= 0) && (connect(probe, (struct sockaddr*)&addr, sizeof(addr)) < 0) ) {
+                unlink(socket_path);
+                if ( bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0 ) rc = 0;
+            }
+            if ( probe >= 0 ) close(probe);
+        }
+        if ( rc ) {
+            fprintf(stderr, "ERROR:  unable to listen on %s: %s\n", socket_path, strerror(rc));
+            close(fd);
+            return rc;
+        }
+    }
+    if ( listen(fd, SOMAXCONN) < 0 ) {
+        rc = errno;
+        fprintf(stderr, "ERROR:  unable to listen on %s: %s\n", socket_path, strerror(rc));
+        close(fd);
+        unlink(socket_path);
+        return rc;
+    }
+
+    snodelist_server_socket_path = socket_path;
+    signal(SIGINT, snodelist_server_signal);
+    signal(SIGTERM, snodelist_server_signal);
+    signal(SIGHUP, snodelist_server_signal);
+    signal(SIGPIPE, SIG_IGN);
+
+    server.defaults = defaults;
+    server.cache = result_cache_create(RESULT_CACHE_MAX_ENTRIES, RESULT_CACHE_MAX_BYTES);
+    pthread_mutex_init(&server.lock, NULL);
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    while ( true ) {
+        snodelist_connection_t  *connection;
+        pthread_t               thread;
+        int                     client_fd = accept(fd, NULL, NULL);
+
+        if ( client_fd < 0 ) {
+            if ( (errno == EINTR) || (errno == ECONNABORTED) ) continue;
+            rc = errno;
+            fprintf(stderr, "ERROR:  unable to accept connection on %s: %s\n", socket_path, strerror(rc));
+            break;
+        }
+        connection = malloc(sizeof(snodelist_connection_t));
+        if ( ! connection ) {
+            fprintf(stderr, "FATAL:  unable to allocate memory for connection\n");
+            exit(ENOMEM);
+        }
+        connection->server = &server;
+        connection->fd = client_fd;
+        if ( pthread_create(&thread, &attr, snodelist_server_connection, connection) != 0 ) {
+            fprintf(stderr, "ERROR:  unable to start a thread for a connection\n");
+            close(client_fd);
+            free(connection);
+        }
+    }
+    close(fd);
+    unlink(socket_path);
+    return rc;
+}
+
+//
+
+/*
+ * Write <word> double-quoted, so that snodelist_batch_split() reads it
+ * back unchanged.
+ */
+static void
+snodelist_query_quoted(
+    output_t        *query,
+    const char      *word
+)
+{
+    output_putc(query, '"');
+    while ( *word ) {
+        if ( *word == '\n' ) {
+            output_puts(query, "\\n");
+            word++;
+            continue;
+        }
+        if ( (*word == '"') || (*word == '\\') ) output_putc(query, '\\');
+        output_putc(query, *word++);
+    }
+    output_putc(query, '"');
+}
+
+/*
+ * Append <word> to the query being built in <query>.
+ */
+static void
+snodelist_query_word(
+    output_t        *query,
+    const char      *word
+)
+{
+    output_putc(query, ' ');
+    snodelist_query_quoted(query, word);
+}
+
+/*
+ * Append a long option and its value (as one word) to the query.
+ */
+static void
+snodelist_query_option(
+    output_t        *query,
+    const char      *option,
+    const char      *value
+)
+{
+    output_puts(query, " --");
+    output_puts(query, option);
+    output_putc(query, '=');
+    snodelist_query_quoted(query, value);
+}
+
+/*
+ * The batch query equivalent to a command, as a newline-terminated
+ * string (the caller frees it).  The query is built from the parsed
+ * options with environment variables already substituted, so the same
+ * command gives the same query whatever the environment it is answered
+ * in -- and every rank of a job gives the same query.  Returns NULL if
+ * the command cannot be expressed as a query:  it reads a nodelist file
+ * or it names no hosts at all (there is no output then, but a query would
+ * fall back to SLURM_JOB_NODELIST).  Newlines in words -- the default
+ * expand delimiter among them -- are written as \n.
+ */
+char*
+snodelist_query_text(
+    const snodelist_options_t   *opts,
+    size_t                      *text_len
+)
+{
+    output_t                    *query;
+    char                        *text;
+    bool                        has_hosts = false;
+    unsigned                    i;
+
+    for ( i = 0; i < opts->includes.count; i++ ) {
+        if ( opts->includes.list[i].type == snodelist_source_file ) return NULL;
+    }
+
+    query = output_create_buffer();
+    output_puts(query, snodelist_mode_strings[opts->mode]);
+    output_puts(query, " -B");
+    snodelist_query_word(query, snodelist_backend_strings[opts->backend]);
+    if ( opts->mode == snodelist_mode_machinefile ) {
+        snodelist_query_word(query, opts->node_list);
+        snodelist_query_word(query, opts->task_count_list);
+        snodelist_query_word(query, opts->machinefile_format);
+        if ( opts->no_repeats ) output_puts(query, " -n");
+        has_hosts = true;
+    } else if ( opts->mode == snodelist_mode_rank ) {
+        if ( opts->rank_query == snodelist_rank_query_ranks ) {
+            snodelist_query_option(query, "host-ranks", opts->rank_host);
+        } else {
+            output_puts(query, (opts->rank_query == snodelist_rank_query_host) ? " --rank-host=" : " --local-rank=");
+            output_int(query, opts->rank);
+        }
+        snodelist_query_word(query, opts->node_list);
+        snodelist_query_word(query, opts->task_count_list);
+        has_hosts = true;
+    } else if ( opts->mode == snodelist_mode_tasks ) {
+        output_puts(query, " --tasks=");
+        output_puts(query, snodelist_tasks_op_strings[opts->tasks_op]);
+        if ( opts->tasks_op == snodelist_tasks_compress ) {
+            for ( i = 0; i < opts->includes.count; i++ ) {
+                const char  *value = opts->includes.list[i].value;
+
+                if ( opts->includes.list[i].type == snodelist_source_env ) value = getenv(value);
+                if ( value && *value ) snodelist_query_word(query, value);
+            }
+        } else {
+            if ( opts->tasks_op == snodelist_tasks_expand ) {
+                output_puts(query, " -d");
+                snodelist_query_word(query, opts->delimiter);
+            }
+            snodelist_query_word(query, opts->task_count_list);
+            if ( opts->tasks_op == snodelist_tasks_validate ) snodelist_query_word(query, opts->node_list);
+        }
+        has_hosts = true;
+    } else if ( opts->mode == snodelist_mode_distribution ) {
+        output_puts(query, " --distribution=");
+        distribution_to_output(query, opts->distribution_plane);
+        if ( opts->rankfile ) output_puts(query, " --rankfile");
+        snodelist_query_word(query, opts->node_list);
+        snodelist_query_word(query, opts->task_count_list);
+        has_hosts = true;
+    } else {
+        if ( opts->mode == snodelist_mode_expand ) {
+            output_puts(query, " -d");
+            snodelist_query_word(query, opts->delimiter);
+            if ( opts->expand_format ) snodelist_query_option(query, "expand-format", opts->expand_format);
+        }
+        if ( opts->do_uniq ) output_puts(query, opts->uniq_stable ? " --unique=stable" : " -u");
+        if ( opts->sort_order ) {
+            output_puts(query, " --sort=");
+            output_puts(query, snodelist_sort_order_strings[opts->sort_order]);
+        }
+        if ( opts->set_op ) {
+            output_puts(query, " --");
+            output_puts(query, snodelist_set_op_strings[opts->set_op]);
+        }
+        if ( opts->mode == snodelist_mode_index ) {
+            /* The server must look for this host, not itself: */
+            char        hostname[HOST_NAME_MAX + 1];
+            const char  *host = snodelist_index_host(opts, hostname);
+
+            if ( ! host ) {
+                output_destroy(query);
+                return NULL;
+            }
+            snodelist_query_option(query, "index-of", host);
+            if ( opts->first_rank_counts ) snodelist_query_option(query, "first-rank", opts->first_rank_counts);
+        }
+        if ( opts->mode == snodelist_mode_tree ) {
+            output_puts(query, " --tree=");
+            output_int(query, opts->tree_width ? opts->tree_width : SNODELIST_TREE_WIDTH_DEFAULT);
+            if ( opts->tree_host ) {
+                char        hostname[HOST_NAME_MAX + 1];
+                const char  *host = snodelist_index_host(opts, hostname);
+
+                if ( ! host ) {
+                    output_destroy(query);
+                    return NULL;
+                }
+                snodelist_query_option(query, "tree-host", host);
+            }
+        }
+        if ( opts->select.exact ) {
+            output_puts(query, " --nth=");
+            output_int(query, opts->select.start);
+        } else if ( opts->select.active ) {
+            output_puts(query, " --slice=");
+            output_int(query, opts->select.start);
+            output_putc(query, ':');
+            if ( opts->select.has_end ) output_int(query, opts->select.end);
+        }
+        if ( opts->split_count || opts->split_size ) {
+            output_puts(query, opts->split_count ? " --split=" : " --split-size=");
+            output_int(query, opts->split_count ? opts->split_count : opts->split_size);
+            if ( opts->split_task_counts ) snodelist_query_option(query, "split-tasks", opts->split_task_counts);
+        }
+        for ( i = 0; i < opts->includes.count; i++ ) {
+            const char  *value = opts->includes.list[i].value;
+
+            if ( opts->includes.list[i].type == snodelist_source_env ) value = getenv(value);
+            if ( value && *value ) {
+                snodelist_query_word(query, value);
+                has_hosts = true;
+            } else if ( opts->set_op ) {
+                /* Empty operands still count:  {} minus B is not B */
+                snodelist_query_word(query, "");
+            }
+        }
+    }
+    for ( i = 0; i < opts->excludes.count; i++ ) {
+        const char  *value = opts->excludes.list[i].value;
+
+        if ( opts->excludes.list[i].type == snodelist_source_env ) value = getenv(value);
+        if ( value && *value ) {
+            output_puts(query, " -x");
+            snodelist_query_word(query, value);
+        }
+    }
+    output_putc(query, '\n');
+
+    *text_len = output_length(query);
+    text = has_hosts ? malloc(*text_len) : NULL;
+    if ( text ) output_copy(query, text);
+    output_destroy(query);
+    return text;
+}
+
+//
+
+/*
+ * Client mode:  with SNODELIST_SOCKET naming a server's socket, a command
+ * is sent to the server as the equivalent batch query rather than run
+ * locally.  Returns false -- having written nothing -- if the command has
+ * to run locally:  it cannot be expressed as a query or the server cannot
+ * be reached.
+ */
+bool
+snodelist_client(
+    const snodelist_options_t   *opts,
+    const char                  *socket_path,
+    output_t                    *out,
+    int                         *rc
+)
+{
+    struct sockaddr_un          addr;
+    char                        buffer[65536], *text, *eol;
+    size_t                      text_len, expected, got = 0;
+    int                         fd, status;
+    ssize_t                     n;
+
+    if ( strlen(socket_path) >= sizeof(addr.sun_path) ) return false;
+    if ( ! (text = snodelist_query_text(opts, &text_len)) ) return false;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if ( (fd < 0) || (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) ) {
+        if ( fd >= 0 ) close(fd);
+        free(text);
+        return false;
+    }
+    for ( got = 0; got < text_len; got += n ) {
+        n = send(fd, text + got, text_len - got, MSG_NOSIGNAL);
+        if ( (n < 0) && (errno == EINTR) ) n = 0;
+        if ( n < 0 ) break;
+    }
+    free(text);
+    shutdown(fd, SHUT_WR);
+
+    /* The header line: */
+    got = 0;
+    while ( ! (eol = memchr(buffer, '\n', got)) && (got < sizeof(buffer)) ) {
+        n = read(fd, buffer + got, sizeof(buffer) - got);
+        if ( (n < 0) && (errno == EINTR) ) continue;
+        if ( n <= 0 ) break;
+        got += n;
+    }
+    if ( eol ) *eol = '\0';
+    if ( ! eol || (sscanf(buffer, "%d %zu", &status, &expected) != 2) ) {
+        close(fd);
+        return false;
+    }
+
+    /* Then exactly <expected> bytes of output: */
+    got -= (eol + 1 - buffer);
+    if ( got > expected ) got = expected;
+    output_write(out, eol + 1, got);
+    while ( got < expected ) {
+        n = read(fd, buffer, (expected - got < sizeof(buffer)) ? (expected - got) : sizeof(buffer));
+        if ( (n < 0) && (errno == EINTR) ) continue;
+        if ( n <= 0 ) break;
+        output_write(out, buffer, n);
+        got += n;
+    }
+    close(fd);
+    if ( got < expected ) {
+        fprintf(stderr, "ERROR:  lost connection to the snodelist server at %s\n", socket_path);
+        status = EIO;
+    }
+    *rc = status;
+    return true;
+}
+
+//
+
+/*
+ * Per-job result cache (--job-cache):  every task of a job runs the same
+ * commands in the same environment, so the first task to run a command
+ * leaves its output in a file named for the job and a hash of the
+ * equivalent batch query, and later tasks map that file and write it out
+ * without doing any work.  The file holds the query text followed by the
+ * output; the text is compared on use, so a hash collision is just a
+ * miss.  Files are written under a temporary name and renamed into place,
+ * so no reader ever sees a partial file.
+ *
+ * A job's files live in one directory, <dir>/snodelist-<job id>-<uid>,
+ * which is private to the caller and is only used if the caller owns it;
+ * --job-cache-clean removes it when the job is over.
+ */
+bool
+snodelist_job_cache(
+    const snodelist_options_t   *opts,
+    const char                  *socket_path,
+    output_t                    *out,
+    int                         *rc
+)
+{
+    const char                  *job_id = getenv("SLURM_JOB_ID");
+    char                        *text, *path, *tmp_path;
+    size_t                      text_len, path_len, dir_len;
+    bool                        hit = false;
+    struct stat                 finfo;
+    output_t                    *result;
+    int                         fd;
+
+    if ( ! job_id || ! *job_id || strchr(job_id, '/') ) return false;
+    if ( ! (text = snodelist_query_text(opts, &text_len)) ) return false;
+
+    path_len = strlen(opts->job_cache_dir) + strlen(job_id) + 64;
+    path = malloc(path_len);
+    tmp_path = malloc(path_len);
+    if ( ! path || ! tmp_path ) {
+        fprintf(stderr, "FATAL:  unable to allocate memory for job cache path\n");
+        exit(ENOMEM);
+    }
+    dir_len = snprintf(path, path_len, "%s/snodelist-%s-%u", opts->job_cache_dir, job_id, (unsigned)getuid());
+    if ( ((mkdir(path, 0700) != 0) && (errno != EEXIST)) || (lstat(path, &finfo) != 0) ||
+         ! S_ISDIR(finfo.st_mode) || (finfo.st_uid != getuid()) ) {
+        free(tmp_path);
+        free(path);
+        free(text);
+        return false;
+    }
+    snprintf(path + dir_len, path_len - dir_len, "/%016llx", (unsigned long long)result_cache_hash(text, text_len));
+
+    fd = open(path, O_RDONLY | O_NOFOLLOW);
+    if ( fd >= 0 ) {
+        if ( (fstat(fd, &finfo) == 0) && S_ISREG(finfo.st_mode) && (finfo.st_uid == getuid()) &&
+             ((size_t)finfo.st_size >= text_len) ) {
+            char    *contents = mmap(NULL, finfo.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+            if ( contents != MAP_FAILED ) {
+                if ( memcmp(contents, text, text_len) == 0 ) {
+                    /* Large outputs are written straight from the mapping: */
+                    output_write(out, contents + text_len, finfo.st_size - text_len);
+                    *rc = 0;
+                    hit = true;
+                }
+                munmap(contents, finfo.st_size);
+            }
+        }
+        close(fd);
+    }
+
+    if ( ! hit ) {
+        result = output_create_buffer();
+        if ( ! socket_path || ! *socket_path || ! snodelist_client(opts, socket_path, result, rc) ) {
+            *rc = snodelist_run(opts, result);
+        }
+        if ( *rc == 0 ) {
+            snprintf(tmp_path, path_len, "%s.XXXXXX", path);
+            fd = mkstemp(tmp_path);
+            if ( fd >= 0 ) {
+                output_t    *file_out = output_create(fd);
+                bool        ok;
+
+                output_write(file_out, text, text_len);
+                output_append(file_out, result);
+                ok = output_destroy(file_out);
+                if ( close(fd) != 0 ) ok = false;
+                if ( ! ok || (rename(tmp_path, path) != 0) ) unlink(tmp_path);
+            }
+        }
+        output_append(out, result);
+        output_destroy(result);
+    }
+    free(tmp_path);
+    free(path);
+    free(text);
+    return true;
+}
+
+/*
+ * Remove the job's cache directories from <dir>:  those of every user when
+ * run as root (as a job epilog is), otherwise only the caller's own.
+ */
+int
+snodelist_job_cache_clean(
+    const char      *dir
+)
+{
+    const char      *job_id = getenv("SLURM_JOB_ID");
+    char            prefix[64];
+    size_t          prefix_len;
+    DIR             *cache_dir;
+    struct dirent   *entry;
+    int             rc = 0;
+
+    if ( ! job_id || ! *job_id || strchr(job_id, '/') || (strlen(job_id) > 32) ) {
+        fprintf(stderr, "ERROR:  --job-cache-clean needs SLURM_JOB_ID\n");
+        return EINVAL;
+    }
+    prefix_len = snprintf(prefix, sizeof(prefix), "snodelist-%s-", job_id);
+    if ( ! (cache_dir = opendir(dir)) ) {
+        rc = errno;
+        fprintf(stderr, "ERROR:  unable to open job cache directory %s: %s\n", dir, strerror(rc));
+        return rc;
+    }
+    while ( (entry = readdir(cache_dir)) ) {
+        const char      *uid_str = entry->d_name + prefix_len;
+        struct dirent   *file;
+        struct stat     finfo;
+        DIR             *job_dir;
+        int             fd;
+
+        if ( strncmp(entry->d_name, prefix, prefix_len) || ! *uid_str ) continue;
+        if ( strspn(uid_str, "0123456789") != strlen(uid_str) ) continue;
+
+        fd = openat(dirfd(cache_dir), entry->d_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+        if ( fd < 0 ) continue;
+        if ( (fstat(fd, &finfo) != 0) || ((getuid() != 0) && (finfo.st_uid != getuid())) ) {
+            close(fd);
+            continue;
+        }
+        if ( ! (job_dir = fdopendir(fd)) ) {
+            close(fd);
+            continue;
+        }
+        while ( (file = readdir(job_dir)) ) {
+            if ( strcmp(file->d_name, ".") && strcmp(file->d_name, "..") ) unlinkat(fd, file->d_name, 0);
+        }
+        closedir(job_dir);
+        if ( unlinkat(dirfd(cache_dir), entry->d_name, AT_REMOVEDIR) != 0 ) {
+            rc = errno;
+            fprintf(stderr, "ERROR:  unable to remove job cache directory %s/%s: %s\n", dir, entry->d_name, strerror(rc));
+        }
+    }
+    closedir(cache_dir);
+    return rc;
+}
+
+//
+
+int
+main(
+    int           argc,
+    char * const  argv[]
+)
+{
+    int                   rc;
+    output_t              *out;
+    const char            *backend_env = getenv("SNODELIST_BACKEND");
+    const char            *socket_env = getenv("SNODELIST_SOCKET");
+    long                  cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+    snodelist_options_t   opts;
+
+    memset(&opts, 0, sizeof(opts));
+    opts.mode = snodelist_mode_default;
+    opts.backend = snodelist_backend_default;
+    if ( backend_env && *backend_env && ! snodelist_backend_from_string(backend_env, &opts.backend) ) exit(EINVAL);
+    opts.threads = (cpu_count > 0) ? cpu_count : 1;
+    opts.delimiter = snodelist_default_delimiter;
+    opts.machinefile_format = snodelist_default_machinefile_format;
+
+    rc = snodelist_options_parse(&opts, argc, argv, false);
+    if ( rc ) exit(rc);
+
+    if ( opts.job_cache_clean_dir ) return snodelist_job_cache_clean(opts.job_cache_clean_dir);
+    if ( opts.serve_socket ) return snodelist_serve(&opts, opts.serve_socket);
+
+    out = output_create(STDOUT_FILENO);
+    if ( opts.batch ) {
+        rc = snodelist_batch(&opts, out);
+    } else if ( opts.job_cache_dir && snodelist_job_cache(&opts, socket_env, out, &rc) ) {
+        /* Answered from (or added to) the job's cache */
+    } else if ( ! socket_env || ! *socket_env || ! snodelist_client(&opts, socket_env, out, &rc) ) {
+        rc = snodelist_run(&opts, out);
+    }
+    if ( ! output_flush(out) ) {
+        fprintf(stderr, "ERROR:  unable to write output: %s\n", strerror(out->error));
+        if ( rc == 0 ) rc = out->error;
+    }
+    output_destroy(out);
+
+    return rc;
+}